@@ -0,0 +1,141 @@
+//===-- IndexedHeap.h -------------------------------------------*- C++ -*-===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef KLEE_INDEXEDHEAP_H
+#define KLEE_INDEXEDHEAP_H
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <functional>
+#include <utility>
+#include <vector>
+
+namespace klee {
+  /// IndexedHeap is a d-ary max heap (the top is the greatest item according
+  /// to Compare, like std::priority_queue) which keeps the keys inline and
+  /// tells every item its position, so that items can be removed or have
+  /// their key changed in O(log n).
+  ///
+  /// IndexOf is a functor returning a reference to the std::size_t in which
+  /// the heap keeps the position of an item. Its initial value doesn't matter,
+  /// the heap checks whether an item is at the position it claims to be.
+  template <class T, class Key, class IndexOf, class Compare = std::less<Key>,
+            unsigned Arity = 4>
+  class IndexedHeap {
+    static_assert(Arity >= 2, "a heap needs at least two children per node");
+
+    std::vector<std::pair<Key, T>> heap;
+    IndexOf indexOf;
+    Compare compare;
+
+  public:
+    bool empty() const { return heap.empty(); }
+    std::size_t size() const { return heap.size(); }
+
+    bool contains(T item) const {
+      std::size_t index = indexOf(item);
+      return index < heap.size() && heap[index].second == item;
+    }
+
+    T top() const {
+      assert(!empty() && "top of an empty heap");
+      return heap.front().second;
+    }
+
+    const Key &topKey() const {
+      assert(!empty() && "top of an empty heap");
+      return heap.front().first;
+    }
+
+    const Key &getKey(T item) const {
+      assert(contains(item) && "item not in heap");
+      return heap[indexOf(item)].first;
+    }
+
+    void push(T item, Key key) {
+      assert(!contains(item) && "item already in heap");
+      heap.emplace_back(std::move(key), item);
+      indexOf(item) = heap.size() - 1;
+      siftUp(heap.size() - 1);
+    }
+
+    /// Change the key of an item in the heap, in either direction.
+    void update(T item, Key key) {
+      assert(contains(item) && "item not in heap");
+      std::size_t index = indexOf(item);
+      heap[index].first = std::move(key);
+      if (!siftUp(index))
+        siftDown(index);
+    }
+
+    void remove(T item) {
+      assert(contains(item) && "item not in heap");
+      std::size_t index = indexOf(item);
+      indexOf(item) = ~std::size_t(0);
+
+      if (index + 1 != heap.size()) {
+        heap[index] = std::move(heap.back());
+        indexOf(heap[index].second) = index;
+        heap.pop_back();
+        if (!siftUp(index))
+          siftDown(index);
+      } else {
+        heap.pop_back();
+      }
+    }
+
+    void pop() { remove(top()); }
+
+  private:
+    void place(std::size_t index, std::pair<Key, T> entry) {
+      heap[index] = std::move(entry);
+      indexOf(heap[index].second) = index;
+    }
+
+    /// Returns true if the item at index moved.
+    bool siftUp(std::size_t index) {
+      std::size_t start = index;
+      std::pair<Key, T> entry = std::move(heap[index]);
+      while (index > 0) {
+        std::size_t parent = (index - 1) / Arity;
+        if (!compare(heap[parent].first, entry.first))
+          break;
+        place(index, std::move(heap[parent]));
+        index = parent;
+      }
+      place(index, std::move(entry));
+      return index != start;
+    }
+
+    void siftDown(std::size_t index) {
+      std::pair<Key, T> entry = std::move(heap[index]);
+      while (true) {
+        std::size_t first = index * Arity + 1;
+        if (first >= heap.size())
+          break;
+
+        std::size_t largest = first;
+        std::size_t last = std::min(first + Arity, heap.size());
+        for (std::size_t child = first + 1; child < last; ++child) {
+          if (compare(heap[largest].first, heap[child].first))
+            largest = child;
+        }
+
+        if (!compare(entry.first, heap[largest].first))
+          break;
+        place(index, std::move(heap[largest]));
+        index = largest;
+      }
+      place(index, std::move(entry));
+    }
+  };
+} // namespace klee
+
+#endif /* KLEE_INDEXEDHEAP_H */
@@ -164,6 +164,10 @@ public:
 
   virtual void getCoveredLines(const ExecutionState &state,
                                std::map<const std::string*, std::set<unsigned> > &res) = 0;
+
+  // musa: whether the state ran any patched code, returns false if that is not tracked
+  // (i.e. the patch-directed searcher is not used)
+  virtual bool getRanPatchedCode(const ExecutionState &state, bool &res) = 0;
 };
 
 } // End klee namespace
@@ -243,6 +243,9 @@ public:
   /// Any state previous to and including this state has run patched code
   bool ranPatchedCode = false;
 
+  /// @brief Position of this state in the heap of the PatchPriority searcher
+  std::size_t patchHeapIndex = 0;
+
 public:
 #ifdef KLEE_UNITTEST
   // provide this function only in the context of unittests
@@ -150,6 +150,15 @@ cl::opt<bool> PrunePaths(
     cl::desc("Enable pruning path for supported searchers (default=false) "),
     cl::cat(TestGenCat));
 
+// Musa: klee-compare replays every test it compares, these are fully concrete so we don't
+// need any of the bookkeeping for exploring symbolic paths
+cl::opt<bool> ConcreteReplay(
+    "concrete-replay", cl::init(false),
+    cl::desc("When replaying a ktest, skip the bookkeeping only needed for "
+             "symbolic exploration: statistics tracking, the process tree and "
+             "the user searcher (default=false)"),
+    cl::cat(SeedingCat));
+
 /* Constraint solving options */
 
 cl::opt<unsigned> MaxSymArraySize(
@@ -589,7 +598,8 @@ Executor::setModule(std::vector<std::unique_ptr<llvm::Module>> &modules,
 
   specialFunctionHandler->bind();
 
-  if (StatsTracker::useStatistics() || userSearcherRequiresMD2U()) {
+  if (!ConcreteReplay &&
+      (StatsTracker::useStatistics() || userSearcherRequiresMD2U())) {
     statsTracker = 
       new StatsTracker(*this,
                        interpreterHandler->getOutputFilename("assembly.ll"),
@@ -933,7 +943,8 @@ void Executor::branch(ExecutionState &state,
       ExecutionState *ns = es->branch();
       addedStates.push_back(ns);
       result.push_back(ns);
-      processTree->attach(es->ptreeNode, ns, es, reason);
+      if (processTree)
+        processTree->attach(es->ptreeNode, ns, es, reason);
     }
   }
 
@@ -1046,7 +1057,8 @@ ref<Expr> Executor::maxStaticPctChecks(ExecutionState &current,
 }
 
 Executor::StatePair Executor::fork(ExecutionState &current, ref<Expr> condition,
-                                   bool isInternal, BranchType reason) {
+                                   bool isInternal, BranchType reason,
+                                   bool pruneTrue, bool pruneFalse) {
   Solver::Validity res;
   std::map< ExecutionState*, std::vector<SeedInfo> >::iterator it = 
     seedMap.find(&current);
@@ -1055,12 +1067,36 @@ Executor::StatePair Executor::fork(ExecutionState &current, ref<Expr> condition,
   if (!isSeeding)
     condition = maxStaticPctChecks(current, condition);
 
+  // musa: under pruning, the patch searcher drops a side of the branch which can't reach patched code as
+  // soon as it's forked, so don't pay for the validity query and the state for that side. All that's left
+  // to check is whether the other side is feasible. Seeding and replaying follow the seeds and the path.
+  bool pruned = (pruneTrue || pruneFalse) && !isa<ConstantExpr>(condition) && !isSeeding &&
+                !replayKTest && !(replayPath && !isInternal);
+  if (pruned && pruneTrue && pruneFalse) {
+    terminateState(current);
+    return StatePair(nullptr, nullptr);
+  }
+
   time::Span timeout = coreSolverTimeout;
   if (isSeeding)
     timeout *= static_cast<unsigned>(it->second.size());
   solver->setTimeout(timeout);
-  bool success = solver->evaluate(current.constraints, condition, res,
-                                  current.queryMetaData);
+  bool success;
+  if (pruned) {
+    bool feasible = false;
+    ref<Expr> taken = pruneTrue ? Expr::createIsZero(condition) : condition;
+    success = solver->mayBeTrue(current.constraints, taken, feasible, current.queryMetaData);
+    // which side the state takes if it can, the constraint is added below
+    res = !feasible ? Solver::Unknown : pruneTrue ? Solver::False : Solver::True;
+    if (success && !feasible) {
+      solver->setTimeout(time::Span());
+      terminateState(current);
+      return StatePair(nullptr, nullptr);
+    }
+  } else {
+    success = solver->evaluate(current.constraints, condition, res,
+                               current.queryMetaData);
+  }
   solver->setTimeout(time::Span());
   if (!success) {
     current.pc = current.prevPC;
@@ -1068,7 +1104,21 @@ Executor::StatePair Executor::fork(ExecutionState &current, ref<Expr> condition,
     return StatePair(nullptr, nullptr);
   }
 
-  if (!isSeeding) {
+  // the state follows one side of what is a symbolic branch, so it is recorded like a fork of which
+  // only that side survived, except that nothing was forked for MaxForks to count
+  if (pruned) {
+    addConstraint(current, res == Solver::True ? condition : Expr::createIsZero(condition));
+    if (symPathWriter && !isInternal) {
+      current.symPathOS << (res == Solver::True ? "1" : "0");
+    }
+    ++current.depth;
+    if (MaxDepth && MaxDepth <= current.depth) {
+      terminateStateEarly(current, "max-depth exceeded.", StateTerminationType::MaxDepth);
+      return StatePair(nullptr, nullptr);
+    }
+  }
+
+  if (!isSeeding && !pruned) {
     if (replayPath && !isInternal) {
       assert(replayPosition<replayPath->size() &&
              "ran out of branches in replay path mode");
@@ -1203,7 +1253,8 @@ Executor::StatePair Executor::fork(ExecutionState &current, ref<Expr> condition,
       }
     }
 
-    processTree->attach(current.ptreeNode, falseState, trueState, reason);
+    if (processTree)
+      processTree->attach(current.ptreeNode, falseState, trueState, reason);
 
     if (pathWriter) {
       // Need to update the pathOS.id field of falseState, otherwise the same id
@@ -2220,7 +2271,16 @@ void Executor::executeInstruction(ExecutionState &state, KInstruction *ki) {
       ref<Expr> cond = eval(ki, 0, state).value;
 
       cond = optimizer.optimizeExpr(cond, false);
-      Executor::StatePair branches = fork(state, cond, false, BranchType::ConditionalBranch);
+
+      // musa: ask the patch searcher which sides it would prune, fork doesn't create those
+      bool pruneTrue = false, pruneFalse = false;
+      if (searcher && !isa<ConstantExpr>(cond)) {
+        pruneTrue = searcher->prunesBranchTo(state, bi->getSuccessor(0));
+        pruneFalse = searcher->prunesBranchTo(state, bi->getSuccessor(1));
+      }
+
+      Executor::StatePair branches = fork(state, cond, false, BranchType::ConditionalBranch,
+                                          pruneTrue, pruneFalse);
 
       // NOTE: There is a hidden dependency here, markBranchVisited
       // requires that we still be in the context of the branch
@@ -3364,7 +3424,8 @@ void Executor::updateStates(ExecutionState *current) {
       seedMap.find(es);
     if (it3 != seedMap.end())
       seedMap.erase(it3);
-    processTree->remove(es->ptreeNode);
+    if (processTree)
+      processTree->remove(es->ptreeNode);
     delete es;
   }
   removedStates.clear();
@@ -3571,8 +3632,9 @@ void Executor::run(ExecutionState &initialState) {
 
   // musa: we need to initalize the patch searcher at a different point in the program
   // so here we can just check if the searcher hasn't been initialized yet
+  // a concrete replay only ever has the one state, so any searcher will do
   if (searcher == nullptr) {
-    searcher = constructUserSearcher(*this);
+    searcher = ConcreteReplay ? new DFSSearcher() : constructUserSearcher(*this);
   }
 
   std::vector<ExecutionState *> newStates(states.begin(), states.end());
@@ -3677,7 +3739,8 @@ void Executor::terminateState(ExecutionState &state) {
     if (it3 != seedMap.end())
       seedMap.erase(it3);
     addedStates.erase(it);
-    processTree->remove(state.ptreeNode);
+    if (processTree)
+      processTree->remove(state.ptreeNode);
     delete &state;
   }
 }
@@ -4503,7 +4566,12 @@ void Executor::runFunctionAsMain(Function *f,
   
   initializeGlobals(*state);
 
-  processTree = std::make_unique<PTree>(state);
+  if (ConcreteReplay && !replayKTest)
+    klee_error("--concrete-replay requires a ktest to replay");
+
+  // nothing forks in a concrete replay, so there is no process tree to maintain
+  if (!ConcreteReplay)
+    processTree = std::make_unique<PTree>(state);
   run(*state);
   processTree = nullptr;
 
@@ -4618,6 +4686,14 @@ void Executor::getCoveredLines(const ExecutionState &state,
   res = state.coveredLines;
 }
 
+bool Executor::getRanPatchedCode(const ExecutionState &state, bool &res) {
+  if (!tracksPatchedCode)
+    return false;
+
+  res = state.ranPatchedCode;
+  return true;
+}
+
 void Executor::doImpliedValueConcretization(ExecutionState &state,
                                             ref<Expr> e,
                                             ref<ConstantExpr> value) {
@@ -4739,7 +4815,7 @@ int *Executor::getErrnoLocation(const ExecutionState &state) const {
 
 
 void Executor::dumpPTree() {
-  if (!::dumpPTree) return;
+  if (!::dumpPTree || !processTree) return;
 
   char name[32];
   snprintf(name, sizeof(name),"ptree%08d.dot", (int) stats::instructions);
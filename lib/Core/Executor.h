@@ -108,11 +108,15 @@ public:
   std::unique_ptr<KModule> kmodule;
 
   // for the patch comparison
+  // musa: only linked and prepared for the PatchExplorer, it is never manifested or executed
   std::unique_ptr<KModule> cmpModule;
 
   // musa: the searcher can check this variable to decide if pruning was enabled
   bool pruning = false;
 
+  // musa: set by the PatchPriority searcher, which keeps ExecutionState::ranPatchedCode up to date
+  bool tracksPatchedCode = false;
+
 private:
   InterpreterHandler *interpreterHandler;
   Searcher *searcher = nullptr;
@@ -342,8 +346,12 @@ private:
   /// Fork current and return states in which condition holds / does
   /// not hold, respectively. One of the states is necessarily the
   /// current state, and one of the states may be null.
+  /// pruneTrue / pruneFalse mark sides the searcher would drop as soon as
+  /// they were forked, those are never created and current follows the
+  /// other side (if it is feasible) without forking.
   StatePair fork(ExecutionState &current, ref<Expr> condition, bool isInternal,
-                 BranchType reason);
+                 BranchType reason, bool pruneTrue = false,
+                 bool pruneFalse = false);
 
   // If the MaxStatic*Pct limits have been reached, concretize the condition and
   // return it. Otherwise, return the unmodified condition.
@@ -553,6 +561,8 @@ public:
                        std::map<const std::string *, std::set<unsigned>> &res)
       override;
 
+  bool getRanPatchedCode(const ExecutionState &state, bool &res) override;
+
   Expr::Width getWidthForLLVMType(llvm::Type *type) const;
   size_t getAllocationAlignment(const llvm::Value *allocSite) const;
 
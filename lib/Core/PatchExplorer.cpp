@@ -1,67 +1,444 @@
 #include "PatchExplorer.h"
 
+#include "klee/Support/ErrorHandling.h"
+
+#include "llvm/ADT/Hashing.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Constants.h"
 #include "llvm/IR/Instruction.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/InstrTypes.h"
+#include "llvm/IR/Metadata.h"
 #include "llvm/IR/Dominators.h"
+#include "llvm/IR/Operator.h"
 #include "llvm/IR/Value.h"
 #include "llvm/IR/CFG.h"
 #include "llvm/IR/Use.h"
 #include "llvm/IR/Argument.h"
 #include "llvm/IR/InlineAsm.h"
 #include "llvm/IR/GlobalAlias.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Process.h"
 #include "llvm/Support/raw_ostream.h"
-// #include "llvm/Transforms/Utils/FunctionComparator.h"
+#include "llvm/Support/xxhash.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
 #include <iostream>
-#include <sstream>
+#include <limits>
+#include <queue>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 #define DEBUG_PRINTS 0
 
-// compare two instructions as strings, return true if they're equal
-// here, we ignore metadata as well as labeled operands, those we compare for equivalence even if they don't match
-bool instructionStringsEquiv(std::string inst1, std::string inst2) {
-    std::stringstream inst1ss(inst1);
-    std::stringstream inst2ss(inst2);
-    std::string substr1 = "", substr2 = "";
-
-    while(inst1ss >> substr1) {
-        inst2ss >> substr2;
-        // ignore metadata
-        // TODO: this can be made more forgiving (e.g. if one instruction has metadata, but the other doesn't)
-        if (substr1[0] == '!' && substr2[0] == '!') {
-            continue;
+namespace {
+llvm::cl::OptionCategory
+    PatchExplorerCat("Patch explorer options",
+                     "These options control the analysis of the patch-priority searcher.");
+
+llvm::cl::opt<std::string> PatchPriorityCache(
+    "patch-priority-cache",
+    llvm::cl::desc("Directory in which to keep the priorities computed for a pair of modules, "
+                   "so later runs on the same pair skip the analysis (default=off)"),
+    llvm::cl::init(""),
+    llvm::cl::cat(PatchExplorerCat));
+
+llvm::cl::opt<unsigned> PatchPriorityCacheVersion(
+    "patch-priority-cache-version",
+    llvm::cl::desc("Analysis version to look up and store the cached priorities under, for testing "
+                   "(default=0, i.e. the version of this build)"),
+    llvm::cl::init(0),
+    llvm::cl::Hidden,
+    llvm::cl::cat(PatchExplorerCat));
+
+llvm::cl::opt<unsigned> PatchAnalysisThreads(
+    "patch-analysis-threads",
+    llvm::cl::desc("Number of threads comparing the functions of the modules (default=0, i.e. one per core)"),
+    llvm::cl::init(0),
+    llvm::cl::cat(PatchExplorerCat));
+
+enum class PriorityMetric { Weight, Distance };
+
+llvm::cl::opt<PriorityMetric> PatchPriorityMetric(
+    "patch-priority-metric",
+    llvm::cl::desc("How the patch-priority searcher prioritizes instructions"),
+    llvm::cl::values(
+        clEnumValN(PriorityMetric::Weight, "weight",
+                   "by how much changed code may still run after them (default)"),
+        clEnumValN(PriorityMetric::Distance, "distance",
+                   "by how close they are to the nearest changed code")),
+    llvm::cl::init(PriorityMetric::Weight),
+    llvm::cl::cat(PatchExplorerCat));
+
+llvm::cl::opt<unsigned> PatchDistanceCallCost(
+    "patch-distance-call-cost",
+    llvm::cl::desc("How many instructions entering a call counts as in the distance to the changed code, "
+                   "so deeper code is further away (default=10)"),
+    llvm::cl::init(10),
+    llvm::cl::cat(PatchExplorerCat));
+
+llvm::cl::opt<bool> DumpPatchPriorities(
+    "dump-patch-priorities",
+    llvm::cl::desc("Print the non-zero priorities and the patch code found by the analysis to stderr (default=false)"),
+    llvm::cl::init(false),
+    llvm::cl::cat(PatchExplorerCat));
+}
+
+// Instructions are matched structurally: value names, labels and metadata are ignored, every struct type
+// is considered the same (their names and numbering differ between modules), and so are all the constant
+// strings (@.str*). Every hash function below goes along with an equivalence check which canonicalizes the
+// same way, the hashes are only used to find the candidates to check.
+
+// TODO: actually compare the values of the strings
+bool isConstantString(const llvm::GlobalValue *gv) {
+    return gv->getName().startswith(".str");
+}
+
+llvm::hash_code typeHash(llvm::Type *ty) {
+    switch (ty->getTypeID()) {
+    case llvm::Type::StructTyID:
+        return llvm::hash_value(ty->getTypeID());
+    case llvm::Type::IntegerTyID:
+        return llvm::hash_combine(ty->getTypeID(), ty->getIntegerBitWidth());
+    case llvm::Type::PointerTyID: {
+        auto *pty = llvm::cast<llvm::PointerType>(ty);
+        if (pty->isOpaque()) {
+            return llvm::hash_combine(ty->getTypeID(), pty->getAddressSpace());
         }
+        return llvm::hash_combine(ty->getTypeID(), pty->getAddressSpace(), typeHash(ty->getPointerElementType()));
+    }
+    case llvm::Type::ArrayTyID:
+        return llvm::hash_combine(ty->getTypeID(), ty->getArrayNumElements(), typeHash(ty->getArrayElementType()));
+    case llvm::Type::FixedVectorTyID:
+    case llvm::Type::ScalableVectorTyID: {
+        auto *vty = llvm::cast<llvm::VectorType>(ty);
+        return llvm::hash_combine(ty->getTypeID(), vty->getElementCount().getKnownMinValue(),
+                                  typeHash(vty->getElementType()));
+    }
+    case llvm::Type::FunctionTyID: {
+        auto *fty = llvm::cast<llvm::FunctionType>(ty);
+        llvm::hash_code h = llvm::hash_combine(ty->getTypeID(), fty->isVarArg(), typeHash(fty->getReturnType()));
+        for (llvm::Type *param : fty->params()) {
+            h = llvm::hash_combine(h, typeHash(param));
+        }
+        return h;
+    }
+    default:
+        return llvm::hash_value(ty->getTypeID());
+    }
+}
 
-        // ignore labeled operands
-        if (substr1[0] == '%' && substr2[0] == '%') {
-            continue;
+bool typesEquiv(llvm::Type *ty1, llvm::Type *ty2) {
+    if (ty1 == ty2) {
+        return true;
+    }
+    if (ty1->getTypeID() != ty2->getTypeID()) {
+        return false;
+    }
+
+    switch (ty1->getTypeID()) {
+    case llvm::Type::StructTyID:
+        return true;
+    case llvm::Type::IntegerTyID:
+        return ty1->getIntegerBitWidth() == ty2->getIntegerBitWidth();
+    case llvm::Type::PointerTyID: {
+        auto *pty1 = llvm::cast<llvm::PointerType>(ty1);
+        auto *pty2 = llvm::cast<llvm::PointerType>(ty2);
+        if (pty1->getAddressSpace() != pty2->getAddressSpace() || pty1->isOpaque() != pty2->isOpaque()) {
+            return false;
+        }
+        return pty1->isOpaque() || typesEquiv(ty1->getPointerElementType(), ty2->getPointerElementType());
+    }
+    case llvm::Type::ArrayTyID:
+        return ty1->getArrayNumElements() == ty2->getArrayNumElements() &&
+               typesEquiv(ty1->getArrayElementType(), ty2->getArrayElementType());
+    case llvm::Type::FixedVectorTyID:
+    case llvm::Type::ScalableVectorTyID: {
+        auto *vty1 = llvm::cast<llvm::VectorType>(ty1);
+        auto *vty2 = llvm::cast<llvm::VectorType>(ty2);
+        return vty1->getElementCount() == vty2->getElementCount() &&
+               typesEquiv(vty1->getElementType(), vty2->getElementType());
+    }
+    case llvm::Type::FunctionTyID: {
+        auto *fty1 = llvm::cast<llvm::FunctionType>(ty1);
+        auto *fty2 = llvm::cast<llvm::FunctionType>(ty2);
+        if (fty1->isVarArg() != fty2->isVarArg() || fty1->getNumParams() != fty2->getNumParams() ||
+            !typesEquiv(fty1->getReturnType(), fty2->getReturnType())) {
+            return false;
         }
+        for (unsigned i = 0; i < fty1->getNumParams(); ++i) {
+            if (!typesEquiv(fty1->getParamType(i), fty2->getParamType(i))) {
+                return false;
+            }
+        }
+        return true;
+    }
+    default:
+        return true;
+    }
+}
 
-        if (substr1 != substr2) {
-            // ignore differing struct nums, not sure if this difference implies anything tho...
-            if (substr1.find("struct") != std::string::npos && substr2.find("struct") != std::string::npos) {
-                continue;
+// where a block is in its function, so block addresses can be compared across modules
+size_t blockIndex(const llvm::BasicBlock *bb) {
+    return std::distance(bb->getParent()->begin(), bb->getIterator());
+}
+
+llvm::hash_code constantHash(const llvm::Constant *c) {
+    llvm::hash_code h = llvm::hash_combine(c->getValueID(), typeHash(c->getType()));
+
+    if (auto *gv = llvm::dyn_cast<llvm::GlobalValue>(c)) {
+        return isConstantString(gv) ? h : llvm::hash_combine(h, gv->getName());
+    }
+    if (auto *ci = llvm::dyn_cast<llvm::ConstantInt>(c)) {
+        return llvm::hash_combine(h, ci->getValue());
+    }
+    if (auto *cfp = llvm::dyn_cast<llvm::ConstantFP>(c)) {
+        return llvm::hash_combine(h, cfp->getValueAPF().bitcastToAPInt());
+    }
+    if (auto *cds = llvm::dyn_cast<llvm::ConstantDataSequential>(c)) {
+        return llvm::hash_combine(h, cds->getRawDataValues());
+    }
+    // the block operand of a block address (computed goto) isn't a constant
+    if (auto *ba = llvm::dyn_cast<llvm::BlockAddress>(c)) {
+        return llvm::hash_combine(h, ba->getFunction()->getName(), blockIndex(ba->getBasicBlock()));
+    }
+    if (auto *ce = llvm::dyn_cast<llvm::ConstantExpr>(c)) {
+        h = llvm::hash_combine(h, ce->getOpcode());
+        if (ce->isCompare()) {
+            h = llvm::hash_combine(h, ce->getPredicate());
+        }
+    }
+    // constant expressions and aggregates, everything else (null, undef, ...) has no operands
+    for (const llvm::Use &op : c->operands()) {
+        h = llvm::hash_combine(h, constantHash(llvm::cast<llvm::Constant>(op.get())));
+    }
+    return h;
+}
+
+bool constantsEquiv(const llvm::Constant *c1, const llvm::Constant *c2) {
+    if (c1->getValueID() != c2->getValueID() || !typesEquiv(c1->getType(), c2->getType())) {
+        return false;
+    }
+
+    if (auto *gv1 = llvm::dyn_cast<llvm::GlobalValue>(c1)) {
+        auto *gv2 = llvm::cast<llvm::GlobalValue>(c2);
+        if (isConstantString(gv1) && isConstantString(gv2)) {
+            return true;
+        }
+        return gv1->getName() == gv2->getName();
+    }
+    if (auto *ci1 = llvm::dyn_cast<llvm::ConstantInt>(c1)) {
+        return ci1->getValue() == llvm::cast<llvm::ConstantInt>(c2)->getValue();
+    }
+    if (auto *cfp1 = llvm::dyn_cast<llvm::ConstantFP>(c1)) {
+        return cfp1->getValueAPF().bitwiseIsEqual(llvm::cast<llvm::ConstantFP>(c2)->getValueAPF());
+    }
+    if (auto *cds1 = llvm::dyn_cast<llvm::ConstantDataSequential>(c1)) {
+        return cds1->getRawDataValues() == llvm::cast<llvm::ConstantDataSequential>(c2)->getRawDataValues();
+    }
+    if (auto *ba1 = llvm::dyn_cast<llvm::BlockAddress>(c1)) {
+        auto *ba2 = llvm::cast<llvm::BlockAddress>(c2);
+        return ba1->getFunction()->getName() == ba2->getFunction()->getName() &&
+               blockIndex(ba1->getBasicBlock()) == blockIndex(ba2->getBasicBlock());
+    }
+    if (auto *ce1 = llvm::dyn_cast<llvm::ConstantExpr>(c1)) {
+        auto *ce2 = llvm::cast<llvm::ConstantExpr>(c2);
+        if (ce1->getOpcode() != ce2->getOpcode() || ce1->getRawSubclassOptionalData() != ce2->getRawSubclassOptionalData() ||
+            (ce1->isCompare() && ce1->getPredicate() != ce2->getPredicate())) {
+            return false;
+        }
+        if (auto *gep1 = llvm::dyn_cast<llvm::GEPOperator>(ce1)) {
+            if (!typesEquiv(gep1->getSourceElementType(), llvm::cast<llvm::GEPOperator>(ce2)->getSourceElementType())) {
+                return false;
             }
+        }
+    }
 
-            // TODO: actually compare the values of the strings
-            // skipping constant strings for now
-            if (substr1.find("@.str") != std::string::npos && substr2.find("@.str") != std::string::npos) {
-                continue;
+    if (c1->getNumOperands() != c2->getNumOperands()) {
+        return false;
+    }
+    for (unsigned int op = 0; op < c1->getNumOperands(); ++op) {
+        if (!constantsEquiv(llvm::cast<llvm::Constant>(c1->getOperand(op)), llvm::cast<llvm::Constant>(c2->getOperand(op)))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// operands defined in the function (instructions, arguments and labels) only contribute what kind of value
+// they are, instructionsEquiv checks their definitions
+llvm::hash_code operandHash(const llvm::Value *op) {
+    if (auto *c = llvm::dyn_cast<llvm::Constant>(op)) {
+        return constantHash(c);
+    }
+    if (auto *ia = llvm::dyn_cast<llvm::InlineAsm>(op)) {
+        return llvm::hash_combine(op->getValueID(), ia->getAsmString(), ia->getConstraintString());
+    }
+    return llvm::hash_value(op->getValueID());
+}
+
+bool operandsEquiv(const llvm::Value *op1, const llvm::Value *op2) {
+    if (auto *c1 = llvm::dyn_cast<llvm::Constant>(op1)) {
+        auto *c2 = llvm::dyn_cast<llvm::Constant>(op2);
+        return c2 && constantsEquiv(c1, c2);
+    }
+    if (auto *ia1 = llvm::dyn_cast<llvm::InlineAsm>(op1)) {
+        auto *ia2 = llvm::dyn_cast<llvm::InlineAsm>(op2);
+        return ia2 && ia1->getAsmString() == ia2->getAsmString() &&
+               ia1->getConstraintString() == ia2->getConstraintString() &&
+               typesEquiv(ia1->getFunctionType(), ia2->getFunctionType());
+    }
+    // metadata operands are ignored as well
+    return op1->getValueID() == op2->getValueID();
+}
+
+// the hash of a single instruction, leaves out where its operands are defined
+// all branches are considered equivalent here, we compare their targets when checking the control flow
+llvm::hash_code instructionHash(const llvm::Instruction *inst) {
+    llvm::hash_code h = llvm::hash_value(inst->getOpcode());
+    if (llvm::isa<llvm::BranchInst>(inst)) {
+        return h;
+    }
+
+    h = llvm::hash_combine(h, typeHash(inst->getType()), inst->getRawSubclassOptionalData(), inst->getNumOperands());
+    if (auto *cmp = llvm::dyn_cast<llvm::CmpInst>(inst)) {
+        h = llvm::hash_combine(h, cmp->getPredicate());
+    } else if (auto *alloca = llvm::dyn_cast<llvm::AllocaInst>(inst)) {
+        h = llvm::hash_combine(h, typeHash(alloca->getAllocatedType()));
+    } else if (auto *gep = llvm::dyn_cast<llvm::GetElementPtrInst>(inst)) {
+        h = llvm::hash_combine(h, typeHash(gep->getSourceElementType()));
+    } else if (auto *load = llvm::dyn_cast<llvm::LoadInst>(inst)) {
+        h = llvm::hash_combine(h, load->getOrdering(), load->getSyncScopeID());
+    } else if (auto *store = llvm::dyn_cast<llvm::StoreInst>(inst)) {
+        h = llvm::hash_combine(h, store->getOrdering(), store->getSyncScopeID());
+    } else if (auto *rmw = llvm::dyn_cast<llvm::AtomicRMWInst>(inst)) {
+        h = llvm::hash_combine(h, rmw->getOperation(), rmw->getOrdering(), rmw->getSyncScopeID());
+    } else if (auto *cx = llvm::dyn_cast<llvm::AtomicCmpXchgInst>(inst)) {
+        h = llvm::hash_combine(h, cx->getSuccessOrdering(), cx->getFailureOrdering(), cx->getSyncScopeID());
+    } else if (auto *fence = llvm::dyn_cast<llvm::FenceInst>(inst)) {
+        h = llvm::hash_combine(h, fence->getOrdering(), fence->getSyncScopeID());
+    } else if (auto *call = llvm::dyn_cast<llvm::CallBase>(inst)) {
+        h = llvm::hash_combine(h, call->getCallingConv());
+        if (auto *ci = llvm::dyn_cast<llvm::CallInst>(call)) {
+            h = llvm::hash_combine(h, ci->getTailCallKind());
+        }
+    }
+
+    for (const llvm::Use &op : inst->operands()) {
+        h = llvm::hash_combine(h, operandHash(op.get()));
+    }
+    return h;
+}
+
+// instructionHash's counterpart, checks everything about the instructions but where their operands are defined
+bool instructionShapesEquiv(const llvm::Instruction *inst1, const llvm::Instruction *inst2) {
+    if (inst1->getOpcode() != inst2->getOpcode() ||
+        inst1->getRawSubclassOptionalData() != inst2->getRawSubclassOptionalData() ||
+        inst1->getNumOperands() != inst2->getNumOperands() ||
+        !typesEquiv(inst1->getType(), inst2->getType())) {
+        return false;
+    }
+
+    if (auto *cmp = llvm::dyn_cast<llvm::CmpInst>(inst1)) {
+        if (cmp->getPredicate() != llvm::cast<llvm::CmpInst>(inst2)->getPredicate()) {
+            return false;
+        }
+    } else if (auto *alloca = llvm::dyn_cast<llvm::AllocaInst>(inst1)) {
+        auto *alloca2 = llvm::cast<llvm::AllocaInst>(inst2);
+        if (alloca->getAlign() != alloca2->getAlign() ||
+            !typesEquiv(alloca->getAllocatedType(), alloca2->getAllocatedType())) {
+            return false;
+        }
+    } else if (auto *gep = llvm::dyn_cast<llvm::GetElementPtrInst>(inst1)) {
+        if (!typesEquiv(gep->getSourceElementType(), llvm::cast<llvm::GetElementPtrInst>(inst2)->getSourceElementType())) {
+            return false;
+        }
+    } else if (auto *load = llvm::dyn_cast<llvm::LoadInst>(inst1)) {
+        auto *load2 = llvm::cast<llvm::LoadInst>(inst2);
+        if (load->getAlign() != load2->getAlign() || load->isVolatile() != load2->isVolatile() ||
+            load->getOrdering() != load2->getOrdering() || load->getSyncScopeID() != load2->getSyncScopeID()) {
+            return false;
+        }
+    } else if (auto *store = llvm::dyn_cast<llvm::StoreInst>(inst1)) {
+        auto *store2 = llvm::cast<llvm::StoreInst>(inst2);
+        if (store->getAlign() != store2->getAlign() || store->isVolatile() != store2->isVolatile() ||
+            store->getOrdering() != store2->getOrdering() || store->getSyncScopeID() != store2->getSyncScopeID()) {
+            return false;
+        }
+    } else if (auto *rmw = llvm::dyn_cast<llvm::AtomicRMWInst>(inst1)) {
+        auto *rmw2 = llvm::cast<llvm::AtomicRMWInst>(inst2);
+        if (rmw->getOperation() != rmw2->getOperation() || rmw->getAlign() != rmw2->getAlign() ||
+            rmw->isVolatile() != rmw2->isVolatile() || rmw->getOrdering() != rmw2->getOrdering() ||
+            rmw->getSyncScopeID() != rmw2->getSyncScopeID()) {
+            return false;
+        }
+    } else if (auto *cx = llvm::dyn_cast<llvm::AtomicCmpXchgInst>(inst1)) {
+        auto *cx2 = llvm::cast<llvm::AtomicCmpXchgInst>(inst2);
+        if (cx->getAlign() != cx2->getAlign() || cx->isVolatile() != cx2->isVolatile() || cx->isWeak() != cx2->isWeak() ||
+            cx->getSuccessOrdering() != cx2->getSuccessOrdering() ||
+            cx->getFailureOrdering() != cx2->getFailureOrdering() || cx->getSyncScopeID() != cx2->getSyncScopeID()) {
+            return false;
+        }
+    } else if (auto *fence = llvm::dyn_cast<llvm::FenceInst>(inst1)) {
+        auto *fence2 = llvm::cast<llvm::FenceInst>(inst2);
+        if (fence->getOrdering() != fence2->getOrdering() || fence->getSyncScopeID() != fence2->getSyncScopeID()) {
+            return false;
+        }
+    } else if (auto *call = llvm::dyn_cast<llvm::CallBase>(inst1)) {
+        // attributes are uniqued in the context both modules share, so they compare as pointers
+        auto *call2 = llvm::cast<llvm::CallBase>(inst2);
+        if (!typesEquiv(call->getFunctionType(), call2->getFunctionType()) ||
+            call->getCallingConv() != call2->getCallingConv() || call->getAttributes() != call2->getAttributes()) {
+            return false;
+        }
+        if (auto *ci = llvm::dyn_cast<llvm::CallInst>(call)) {
+            if (ci->getTailCallKind() != llvm::cast<llvm::CallInst>(call2)->getTailCallKind()) {
+                return false;
             }
+        }
+    } else if (auto *ev = llvm::dyn_cast<llvm::ExtractValueInst>(inst1)) {
+        if (ev->getIndices() != llvm::cast<llvm::ExtractValueInst>(inst2)->getIndices()) {
+            return false;
+        }
+    } else if (auto *iv = llvm::dyn_cast<llvm::InsertValueInst>(inst1)) {
+        if (iv->getIndices() != llvm::cast<llvm::InsertValueInst>(inst2)->getIndices()) {
+            return false;
+        }
+    } else if (auto *sv = llvm::dyn_cast<llvm::ShuffleVectorInst>(inst1)) {
+        if (sv->getShuffleMask() != llvm::cast<llvm::ShuffleVectorInst>(inst2)->getShuffleMask()) {
+            return false;
+        }
+    }
 
+    for (unsigned int op = 0; op < inst1->getNumOperands(); ++op) {
+        if (!operandsEquiv(inst1->getOperand(op), inst2->getOperand(op))) {
             return false;
         }
     }
     return true;
 }
 
+// the hash of a basic block, combines the hashes of its instructions (ignoring debug)
+uint64_t blockHash(llvm::BasicBlock &bb) {
+    llvm::hash_code h = llvm::hash_value(0);
+    for (llvm::Instruction &inst : bb.instructionsWithoutDebug()) {
+        h = llvm::hash_combine(h, instructionHash(&inst));
+    }
+    return h;
+}
+
 // recursively check that two instructions are equivalent (i.e. they are identical except for operand names,
 // and their operands are defined in equivalent instructions)
 bool instructionsEquiv(llvm::Instruction *inst1, llvm::Instruction *inst2, std::unordered_map<llvm::Instruction *, llvm::Instruction *> &memo) {
@@ -69,47 +446,25 @@ bool instructionsEquiv(llvm::Instruction *inst1, llvm::Instruction *inst2, std::
     assert(!llvm::isa<llvm::BranchInst>(inst1));
 
     // check the memo first to avoid redundant calls
-    if (memo.count(inst1) != 0 && memo[inst1] == inst2) {
+    auto it = memo.find(inst1);
+    if (it != memo.end() && it->second == inst2) {
         return true;
     }
 
-    // check if the two instructions are syntactically equivalent
-    std::string inst1string, inst2string;
-    llvm::raw_string_ostream(inst1string) << *inst1;
-    llvm::raw_string_ostream(inst2string) << *inst2;
-
-    if (!instructionStringsEquiv(inst1string, inst2string)) {
+    // check if the two instructions are structurally equivalent
+    if (!instructionShapesEquiv(inst1, inst2)) {
         if (DEBUG_PRINTS) {
-            llvm::errs() << "Inst: " << inst1string << " vs " << inst2string << " not equiv: strings\n";
+            llvm::errs() << "Inst: " << *inst1 << " vs " << *inst2 << " not equiv: structure\n";
         }
 
         return false;
     }
 
-    // TODO: this might be better than comparing instructions as strings if it works...
-    // if (!inst1->isSameOperationAs(inst2)) {
-    //     return false;
-    // }
-
     // check that all operands are defined in equivalent instructions
-    assert(inst1->getNumOperands() == inst2->getNumOperands() && "this shouldn't happen (instructions have different num operands)");
-
+    // (constants were already compared, and the operands are of the same kinds)
     for (unsigned int op = 0; op < inst1->getNumOperands(); ++op) {
-        llvm::Value *inst1op = inst1->getOperand(op);
-        llvm::Value *inst2op = inst2->getOperand(op);
-
-        if (llvm::isa<llvm::Constant>(inst1op)) {
-            if(!llvm::isa<llvm::Constant>(inst2op)) {
-                // cutting a corner here by requiring the operands appear in the same order
-                // so unless both are constants (we've already determined they're equal in the string)
-                // we'll say the instructions are not equivalent
-                return false;
-            }
-            continue;
-        }
-
-        llvm::Instruction *inst1opDef = llvm::dyn_cast<llvm::Instruction>(inst1op);
-        llvm::Instruction *inst2opDef = llvm::dyn_cast<llvm::Instruction>(inst2op);
+        llvm::Instruction *inst1opDef = llvm::dyn_cast<llvm::Instruction>(inst1->getOperand(op));
+        llvm::Instruction *inst2opDef = llvm::dyn_cast<llvm::Instruction>(inst2->getOperand(op));
 
         if (inst1opDef == nullptr) {
             assert(inst2opDef == nullptr);
@@ -127,6 +482,334 @@ bool instructionsEquiv(llvm::Instruction *inst1, llvm::Instruction *inst2, std::
     return true;
 }
 
+// check that two basic blocks are equivalent, instruction by instruction except the terminating branches
+bool blocksEquiv(llvm::BasicBlock &bb, llvm::BasicBlock &cmpBB, std::unordered_map<llvm::Instruction *, llvm::Instruction *> &memo) {
+    // iterate through instructions in both BBs, ignoring debug
+    auto mainBBIter = bb.instructionsWithoutDebug().begin();
+    auto cmpBBIter = cmpBB.instructionsWithoutDebug().begin();
+
+    while(mainBBIter != bb.instructionsWithoutDebug().end()) {
+        // if we run out of instructions in cmpBB before the main bb
+        // need to check this first!
+        if (cmpBBIter == cmpBB.instructionsWithoutDebug().end()) {
+            return false;
+        }
+
+        // compare each instruction for equivalence except the terminator (branch)
+        // TODO: also for return instructions(?)
+        if (llvm::isa<llvm::BranchInst>(*mainBBIter)) { 
+            if (!llvm::isa<llvm::BranchInst>(*cmpBBIter)) {
+                return false;
+            }
+
+            // reached branch in both basic blocks
+            mainBBIter++;
+            cmpBBIter++;
+            continue; // to next instruciton in bb (should exit loop)
+        }
+
+        // if instructions are not equivalent, the blocks aren't
+        if (!instructionsEquiv(&*mainBBIter, &*cmpBBIter, memo)) {
+            return false;
+        }
+
+        mainBBIter++;
+        cmpBBIter++;
+    }
+
+    // if there are more instructions in cmpBB, they aren't equivalent
+    return cmpBBIter == cmpBB.instructionsWithoutDebug().end();
+}
+
+// check that two functions are identical up to names, i.e. every instruction is structurally equivalent to the
+// one in the same place of the other function, and uses the arguments, instructions and blocks in the same places
+// this is linear in the size of the functions and stops at the first difference
+bool functionsEquiv(llvm::Function &func, llvm::Function &cmpFunc) {
+    if (func.size() != cmpFunc.size() || func.arg_size() != cmpFunc.arg_size() ||
+        !typesEquiv(func.getFunctionType(), cmpFunc.getFunctionType())) {
+        return false;
+    }
+
+    // first map every value defined in func to its counterpart, operands can be defined after they're used
+    std::unordered_map<const llvm::Value *, const llvm::Value *> valueMap;
+    for (auto arg = func.arg_begin(), cmpArg = cmpFunc.arg_begin(); arg != func.arg_end(); ++arg, ++cmpArg) {
+        valueMap[&*arg] = &*cmpArg;
+    }
+
+    for (auto bb = func.begin(), cmpBB = cmpFunc.begin(); bb != func.end(); ++bb, ++cmpBB) {
+        valueMap[&*bb] = &*cmpBB;
+
+        auto insts = bb->instructionsWithoutDebug();
+        auto cmpInsts = cmpBB->instructionsWithoutDebug();
+        auto inst = insts.begin(), cmpInst = cmpInsts.begin();
+        for (; inst != insts.end() && cmpInst != cmpInsts.end(); ++inst, ++cmpInst) {
+            if (!instructionShapesEquiv(&*inst, &*cmpInst)) {
+                return false;
+            }
+            valueMap[&*inst] = &*cmpInst;
+        }
+
+        if (inst != insts.end() || cmpInst != cmpInsts.end()) {
+            return false;
+        }
+    }
+
+    // then check that every instruction uses its counterparts (constants were compared already)
+    for (llvm::BasicBlock &bb : func) {
+        for (llvm::Instruction &inst : bb.instructionsWithoutDebug()) {
+            const llvm::Instruction *cmpInst = llvm::cast<llvm::Instruction>(valueMap[&inst]);
+
+            for (unsigned int op = 0; op < inst.getNumOperands(); ++op) {
+                const llvm::Value *operand = inst.getOperand(op);
+                if (llvm::isa<llvm::Constant>(operand) || llvm::isa<llvm::InlineAsm>(operand) ||
+                    llvm::isa<llvm::MetadataAsValue>(operand)) {
+                    continue;
+                }
+
+                auto mapped = valueMap.find(operand);
+                if (mapped == valueMap.end() || mapped->second != cmpInst->getOperand(op)) {
+                    return false;
+                }
+            }
+
+            // the blocks a phi takes its values from aren't operands, check those as well
+            if (auto *phi = llvm::dyn_cast<llvm::PHINode>(&inst)) {
+                auto *cmpPhi = llvm::cast<llvm::PHINode>(cmpInst);
+                for (unsigned int in = 0; in < phi->getNumIncomingValues(); ++in) {
+                    if (valueMap[phi->getIncomingBlock(in)] != cmpPhi->getIncomingBlock(in)) {
+                        return false;
+                    }
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+// the results of analysing a single function, filled in by the thread which analysed it and merged afterwards
+struct FunctionAnalysis {
+    std::unordered_map<llvm::BasicBlock *, int> bbweights;
+    std::unordered_set<llvm::BasicBlock *> patchBlocks;
+    std::unordered_map<llvm::BasicBlock *, std::unordered_set<llvm::BasicBlock *>> bbEquivSets;
+    std::unordered_map<llvm::Instruction *, uint64_t> priorities;
+};
+
+// run work(index) for every function in funcs on a pool of threads
+// work only reads the IR, and only writes the results for its own function
+template <typename Work>
+void forEachFunction(const std::vector<llvm::Function *> &funcs, Work work) {
+    unsigned numThreads = PatchAnalysisThreads;
+    if (numThreads == 0) {
+        numThreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    std::atomic<size_t> next(0);
+    auto worker = [&]() {
+        for (size_t index = next++; index < funcs.size(); index = next++) {
+            work(index);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned t = 1; t < numThreads && t < funcs.size(); ++t) {
+        threads.emplace_back(worker);
+    }
+    worker();
+
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+}
+
+// whether each phi of bb takes its values from the equivalents of the blocks the phi in the same place of cmpBB
+// takes them from. A block whose own code was changed by the patch has no equivalent, and says nothing either way
+bool phiSourcesEquiv(llvm::BasicBlock &bb, llvm::BasicBlock &cmpBB,
+                     const std::unordered_map<llvm::BasicBlock *, std::unordered_set<llvm::BasicBlock *>> &bbEquivSets) {
+    auto cmpPhi = cmpBB.phis().begin();
+
+    for (llvm::PHINode &phi : bb.phis()) {
+        if (cmpPhi == cmpBB.phis().end() || phi.getNumIncomingValues() != cmpPhi->getNumIncomingValues()) {
+            return false;
+        }
+
+        for (unsigned i = 0; i < phi.getNumIncomingValues(); ++i) {
+            auto equiv = bbEquivSets.find(phi.getIncomingBlock(i));
+            if (equiv != bbEquivSets.end() && equiv->second.count(cmpPhi->getIncomingBlock(i)) == 0) {
+                return false;
+            }
+        }
+        ++cmpPhi;
+    }
+
+    return true;
+}
+
+// compare the BBs of a function with the ones of its original version
+void matchFunction(llvm::Function &func, llvm::Module *cmpModule, FunctionAnalysis &res) {
+    llvm::Function *cmpFunc = cmpModule->getFunction(func.getName());
+
+    if (cmpFunc == nullptr) {
+        if (DEBUG_PRINTS) {
+            llvm::errs() << "Function: " << func.getName().str() << " does NOT exist in original bitcode\n";
+        }
+
+        // if this function is new, assign all BBs a weight of 1
+        for (llvm::BasicBlock &bb : func) {
+            res.bbweights[&bb] = 1;
+            res.patchBlocks.insert(&bb);
+        }
+        return;
+    }
+
+    // skip functions which are identical but for names, which is most of them (e.g. all of the runtime),
+    // every BB is equivalent to the one in the same place of the cmpFunc
+    if (functionsEquiv(func, *cmpFunc)) {
+        for (auto bb = func.begin(), cmpBB = cmpFunc->begin(); bb != func.end(); ++bb, ++cmpBB) {
+            res.bbweights[&*bb] = 0;
+            res.bbEquivSets[&*bb].insert(&*cmpBB);
+        }
+        return;
+    }
+
+    // memo used for recursively checking equivalence in instructions, instantiated per function
+    std::unordered_map<llvm::Instruction *, llvm::Instruction *> instEquivMemo;
+
+    // index the BBs of the cmpFunc by their hash, so we only check the BBs which can be equivalent
+    std::unordered_map<uint64_t, std::vector<llvm::BasicBlock *>> cmpBBIndex;
+    for (llvm::BasicBlock &cmpBB : *cmpFunc) {
+        cmpBBIndex[blockHash(cmpBB)].push_back(&cmpBB);
+    }
+
+    // for each BasicBlock, check the blocks in the cmpFunc with the same hash and see if any are equivalent
+    for (llvm::BasicBlock &bb : func) {
+        // initialize weight to be 1 in case we don't find an equiv BB
+        res.bbweights[&bb] = 1;
+        res.patchBlocks.insert(&bb);
+
+        auto candidates = cmpBBIndex.find(blockHash(bb));
+        if (candidates == cmpBBIndex.end()) {
+            continue; // to next bb in mainFunc
+        }
+
+        for (llvm::BasicBlock *cmpBB : candidates->second) {
+            if (blocksEquiv(bb, *cmpBB, instEquivMemo)) {
+                res.bbEquivSets[&bb].insert(cmpBB);
+                res.bbweights[&bb] = 0;
+                res.patchBlocks.erase(&bb);
+                // break; // to next bb in mainFunc
+            }
+        }
+    }
+
+    // blocksEquiv doesn't see which block a phi takes each value from, so drop the equivalent blocks whose phis
+    // take them from other blocks. The equivalences are only dropped once all the blocks were checked against them
+    std::vector<std::pair<llvm::BasicBlock *, llvm::BasicBlock *>> phisChanged;
+    for (auto &equiv : res.bbEquivSets) {
+        if (!llvm::isa<llvm::PHINode>(equiv.first->front())) {
+            continue;
+        }
+
+        for (llvm::BasicBlock *cmpBB : equiv.second) {
+            if (!phiSourcesEquiv(*equiv.first, *cmpBB, res.bbEquivSets)) {
+                phisChanged.push_back({equiv.first, cmpBB});
+            }
+        }
+    }
+
+    for (auto &changed : phisChanged) {
+        auto equiv = res.bbEquivSets.find(changed.first);
+        equiv->second.erase(changed.second);
+
+        if (equiv->second.empty()) {
+            res.bbEquivSets.erase(equiv);
+            res.bbweights[changed.first] = 1;
+            res.patchBlocks.insert(changed.first);
+        }
+    }
+}
+
+// back propagate the weights of the instructions of a function to their priorities within the function
+// priorities only gets the function's own instructions
+void propagateFunction(llvm::Function &f, const std::unordered_map<llvm::Instruction *, int> &instweights,
+                       std::unordered_map<llvm::Instruction *, uint64_t> &priorities) {
+    llvm::DominatorTree dom(f);
+
+    // Find the ending basic blocks
+    std::unordered_set<llvm::BasicBlock*> endBlocks, bbSet, traversed;
+
+    llvm::BasicBlock *entry = &f.getEntryBlock();
+    assert(entry);
+    bbSet.insert(entry);
+
+    while(bbSet.size()) {
+        llvm::BasicBlock *bb = *bbSet.begin();
+        assert(bb);
+        bbSet.erase(bbSet.begin());
+        traversed.insert(bb);
+
+        if (llvm::succ_empty(bb)) {
+            endBlocks.insert(bb);
+        } else {
+            for (llvm::BasicBlock *sbb : llvm::successors(bb)) {
+                assert(sbb);
+                if (traversed.count(sbb)) continue;
+                if (!dom.dominates(sbb, bb)) bbSet.insert(sbb);
+            }
+        }
+    }
+
+    // errs() << "\tfound terminators" << "\n";
+    bbSet = endBlocks;
+
+    /**
+    * Propagating the priority is slightly trickier than just finding the 
+    * terminal basic blocks, as different paths can have different priorities.
+    * So, we annotate the propagated with the priority. If the priority changed,
+    * then reprop.
+    */
+
+    std::unordered_map<llvm::BasicBlock*, uint64_t> prop;
+
+    while (bbSet.size()) {
+        llvm::BasicBlock *bb = *bbSet.begin();
+        assert(bb);
+        bbSet.erase(bbSet.begin());
+
+        llvm::Instruction *pi = bb->getTerminator();
+        if (!pi) {
+            assert(f.isDeclaration());
+            continue; // empty body
+        }
+
+        if (prop.count(bb) && prop[bb] == priorities[pi]) {
+            continue;
+        }
+        prop[bb] = priorities[pi];
+
+        llvm::Instruction *i = pi->getPrevNode();
+        while (i) {
+            priorities[i] = priorities[pi] + instweights.at(i);
+            pi = i;
+            i = pi->getPrevNode();
+        }
+
+        for (llvm::BasicBlock *pbb : llvm::predecessors(bb)) {
+            assert(pbb);
+            
+            // if (!dom.dominates(bb, pbb)) bbSet.insert(pbb);
+            if (!prop.count(pbb)) bbSet.insert(pbb);
+
+            // this gives a more accurate propagation, but hangs on some functions
+            // bbSet.insert(pbb);
+
+            llvm::Instruction *term = pbb->getTerminator();
+            priorities[term] = std::max(priorities[term], 
+                                        instweights.at(term) + priorities[pi]); 
+        }
+    }
+}
+
 // helper function from Agamotto
 // https://github.com/efeslab/agamotto/blob/artifact-eval-osdi20/lib/Core/NvmAnalysisUtils.cpp
 llvm::Instruction *getReturnLocation(llvm::CallBase *cb) {
@@ -158,112 +841,309 @@ llvm::Function *getCallInstFunction(llvm::CallBase *cb) {
     return nullptr;
 }
 
-namespace klee {
+// the possible targets of indirect calls: the functions whose address is taken, indexed by their type and by the
+// function types their address is bitcast to. A function whose address only reaches a call through a cast to
+// another kind of pointer (e.g. void *) or an integer and back is still only found by its own type
+struct IndirectCallTargets {
+    std::unordered_map<llvm::FunctionType *, std::vector<llvm::Function *>> byType;
 
-PatchExplorer::PatchExplorer(Executor *executor)
-    : mainModule(executor->kmodule->module.get()),
-      cmpModule(executor->cmpModule->module.get()) {
-    
-    pruning = executor->pruning;
+    // these may also be called with more arguments than they have parameters
+    std::vector<llvm::Function *> varArg;
 
-    // STEP 1: compute weights of BBs
-    std::unordered_map<llvm::BasicBlock *, int> bbweights;
+    explicit IndirectCallTargets(llvm::Module *module) {
+        for (llvm::Function &f : *module) {
+            // a function can't be called through a pointer unless its address is taken somewhere
+            if (f.isIntrinsic() || !f.hasAddressTaken()) continue;
 
-    // auto curr = mainModule->getFunction(executor->entryPoint)->getEntryBlock().getFirstNonPHIOrDbgOrLifetime();
+            std::unordered_set<llvm::FunctionType *> types = { f.getFunctionType() };
+            castTypes(&f, types);
+            for (llvm::FunctionType *type : types) {
+                byType[type].push_back(&f);
+            }
 
-    // map of equivalence between BBs (patched -> original) for checking control flow
-    // use a set for the case of multiple equivalent blocks
-    std::unordered_map<llvm::BasicBlock *, std::unordered_set<llvm::BasicBlock *>> bbEquivSets;
-    
-    for (llvm::Function &func : *mainModule) {
-        // llvm::errs() << "Function: " << func.getName().str() << "\n";
-        llvm::Function *cmpFunc = cmpModule->getFunction(func.getName());
+            if (f.isVarArg()) {
+                varArg.push_back(&f);
+            }
+        }
+    }
+
+    // the function types v is bitcast to, directly or through other bitcasts
+    static void castTypes(llvm::Value *v, std::unordered_set<llvm::FunctionType *> &types) {
+        for (llvm::User *user : v->users()) {
+            if (!llvm::isa<llvm::BitCastOperator>(user)) continue;
 
-        if (cmpFunc == nullptr) {
-            if (DEBUG_PRINTS) {
-                llvm::errs() << "Function: " << func.getName().str() << " does NOT exist in original bitcode\n";
+            if (auto *type = llvm::dyn_cast<llvm::FunctionType>(user->getType()->getPointerElementType())) {
+                types.insert(type);
             }
+            castTypes(user, types);
+        }
+    }
 
-            // if this function is new, assign all BBs a weight of 1
-            for (llvm::BasicBlock &bb : func) {
-                bbweights[&bb] = 1;
-                patchInstructions.insert(&bb);
+    void lookup(llvm::CallBase *cb, std::unordered_set<llvm::Function *> &possibleFns) const {
+        llvm::FunctionType *type = cb->getFunctionType();
+        auto it = byType.find(type);
+        if (it != byType.end()) {
+            possibleFns.insert(it->second.begin(), it->second.end());
+        }
+
+        // variadic functions match if their parameters are a prefix of the arguments
+        for (llvm::Function *f : varArg) {
+            llvm::FunctionType *fType = f->getFunctionType();
+            if (fType == type || fType->getNumParams() > cb->arg_size()) continue;
+
+            unsigned i = 0;
+            while (i < fType->getNumParams() && fType->getParamType(i) == cb->getArgOperand(i)->getType()) {
+                ++i;
+            }
+            if (i == fType->getNumParams()) {
+                possibleFns.insert(f);
             }
-            continue; // to next function
         }
+    }
+};
+
+// the functions a call site may call
+void possibleCallees(llvm::CallBase *cb, const IndirectCallTargets &indirectTargets,
+                     std::unordered_set<llvm::Function *> &possibleFns) {
+    if (llvm::Function *f = getCallInstFunction(cb)) {
+        possibleFns.insert(f);
+    } else if (llvm::Function *f = cb->getCalledFunction()) {
+        possibleFns.insert(f);
+    } else if (auto *f = llvm::dyn_cast<llvm::Function>(cb->getCalledOperand()->stripPointerCasts())) {
+        possibleFns.insert(f);
+    } else if (llvm::GlobalAlias *ga = llvm::dyn_cast<llvm::GlobalAlias>(cb->getCalledOperand())) {
+        llvm::Function *f = llvm::dyn_cast<llvm::Function>(ga->getAliasee());
+        assert(f && "bad assumption about aliases!");
+        possibleFns.insert(f);
+    } else if (llvm::GlobalAlias *ga = llvm::dyn_cast<llvm::GlobalAlias>(cb->getCalledOperand()->stripPointerCasts())) {
+        llvm::Function *f = llvm::dyn_cast<llvm::Function>(ga->getAliasee());
+        assert(f && "bad assumption about aliases!");
+        possibleFns.insert(f);
+    } else {
+        // TODO: dealing with function pointers
+        // Edge case related to exit() function giving itself weight by calling a function pointer with same args
+        // results in weight propogating throughout program from exit (less accurate pruning).
+
+        if (!cb->isIndirectCall()) llvm::errs() << *cb << "\n";
+        assert(cb->isIndirectCall());
+
+        indirectTargets.lookup(cb, possibleFns);
+    }
+}
 
-        // skip functions which have the same hash, speeds up analysis
-        // if (llvm::FunctionComparator::functionHash(func) == llvm::FunctionComparator::functionHash(*cmpFunc)) {
-        //     for (llvm::BasicBlock &bb : func) {
-        //         bbweights[&bb] = 0;
-        //     }
-        //     continue; // to next function
-        // }
-        // TODO: segfaults :(
-        
-        
-        // memo used for recursively checking equivalence in instructions, instantiated per function
-        std::unordered_map<llvm::Instruction *, llvm::Instruction *> instEquivMemo;
+// a call site and the functions it may call, by their index in the module
+struct CallSite {
+    llvm::CallBase *cb;
+    unsigned caller;
+    std::vector<unsigned> callees;
+};
+
+// Tarjan's algorithm, returns the strongly connected components of the graph with every
+// component after all the components it has edges to (i.e. callees before their callers)
+std::vector<std::vector<unsigned>> stronglyConnectedComponents(const std::vector<std::vector<unsigned>> &succs) {
+    const unsigned unvisited = ~0u;
+    std::vector<std::vector<unsigned>> sccs;
+    std::vector<unsigned> index(succs.size(), unvisited), lowlink(succs.size());
+    std::vector<bool> onStack(succs.size());
+    std::vector<unsigned> stack;
+    unsigned counter = 0;
+
+    // the DFS is iterative since call chains can be deep, every entry is a node and its next successor
+    std::vector<std::pair<unsigned, unsigned>> dfs;
+    auto visit = [&](unsigned v) {
+        index[v] = lowlink[v] = counter++;
+        stack.push_back(v);
+        onStack[v] = true;
+        dfs.emplace_back(v, 0);
+    };
+
+    for (unsigned root = 0; root < succs.size(); ++root) {
+        if (index[root] != unvisited) {
+            continue;
+        }
+        visit(root);
+
+        while (!dfs.empty()) {
+            unsigned v = dfs.back().first;
+            if (dfs.back().second < succs[v].size()) {
+                unsigned w = succs[v][dfs.back().second++];
+                if (index[w] == unvisited) {
+                    visit(w);
+                } else if (onStack[w]) {
+                    lowlink[v] = std::min(lowlink[v], index[w]);
+                }
+                continue;
+            }
 
-        // for each BasicBlock, check every block in the cmpFunc and see if any are equivalent
-        for (llvm::BasicBlock &bb : func) {
-            // initialize weight to be 1 in case we don't find an equiv BB
-            bbweights[&bb] = 1;
-            patchInstructions.insert(&bb);
-
-            for (llvm::BasicBlock &cmpBB : *cmpFunc) {
-                // init to true, set to false if this BB we're checking was not equiv
-                bool foundEquiv = true;
-
-                // iterate through instructions in both BBs, ignoring debug
-                auto mainBBIter = bb.instructionsWithoutDebug().begin();
-                auto cmpBBIter = cmpBB.instructionsWithoutDebug().begin();
-
-                while(mainBBIter != bb.instructionsWithoutDebug().end()) {
-                    // if we run out of instructions in cmpBB before the main bb
-                    // need to check this first!
-                    if (cmpBBIter == cmpBB.instructionsWithoutDebug().end()) {
-                        foundEquiv = false;
-                        break; // to next bb in cmpFunc
-                    }
+            if (lowlink[v] == index[v]) {
+                sccs.emplace_back();
+                unsigned w;
+                do {
+                    w = stack.back();
+                    stack.pop_back();
+                    onStack[w] = false;
+                    sccs.back().push_back(w);
+                } while (w != v);
+            }
 
-                    // compare each instruction for equivalence except the terminator (branch)
-                    // TODO: also for return instructions(?)
-                    if (llvm::isa<llvm::BranchInst>(*mainBBIter)) { 
-                        if (!llvm::isa<llvm::BranchInst>(*cmpBBIter)) {
-                            foundEquiv = false;
-                            break; // to next bb in cmpFunc
-                        }
-
-                        // reached branch in both basic blocks
-                        mainBBIter++;
-                        cmpBBIter++;
-                        continue; // to next instruciton in bb (should exit loop)
-                    }
+            dfs.pop_back();
+            if (!dfs.empty()) {
+                unsigned parent = dfs.back().first;
+                lowlink[parent] = std::min(lowlink[parent], lowlink[v]);
+            }
+        }
+    }
 
-                    // if instructions are not equivalent, break to next BB
-                    if (!instructionsEquiv(&*mainBBIter, &*cmpBBIter, instEquivMemo)) {
-                        foundEquiv = false;
-                        break; // to next bb in cmpFunc
-                    }
+    return sccs;
+}
+
+// priorities by the distance to the nearest patch code, which is the number of instructions executed to get
+// there plus PatchDistanceCallCost for every call entered on the way
+// computed with Dijkstra's algorithm backwards from the patch code over the interprocedural CFG, where functions
+// return to all of their call sites, the closer an instruction the higher its priority and 0 if it can't get there
+void distancePriorities(const std::vector<llvm::Function *> &funcs,
+                        const std::unordered_map<llvm::Function *, unsigned> &funcIndex,
+                        const std::vector<CallSite> &callSites,
+                        const std::vector<std::vector<unsigned>> &calledFrom,
+                        const std::unordered_set<llvm::BasicBlock *> &patchBlocks,
+                        std::unordered_map<llvm::Instruction *, uint64_t> &priorities) {
+    std::unordered_map<const llvm::Instruction *, unsigned> siteOf;
+    for (unsigned site = 0; site < callSites.size(); ++site) {
+        siteOf[callSites[site].cb] = site;
+    }
+
+    std::vector<std::vector<llvm::Instruction *>> returns(funcs.size());
+    for (unsigned f = 0; f < funcs.size(); ++f) {
+        for (llvm::BasicBlock &bb : *funcs[f]) {
+            if (llvm::isa<llvm::ReturnInst>(bb.getTerminator())) {
+                returns[f].push_back(bb.getTerminator());
+            }
+        }
+    }
+
+    typedef std::pair<uint64_t, llvm::Instruction *> Entry;
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> queue;
+    std::unordered_map<llvm::Instruction *, uint64_t> distance;
+
+    auto reach = [&](llvm::Instruction *inst, uint64_t d) {
+        auto it = distance.find(inst);
+        if (it == distance.end() || d < it->second) {
+            distance[inst] = d;
+            queue.emplace(d, inst);
+        }
+    };
+
+    for (llvm::BasicBlock *bb : patchBlocks) {
+        for (llvm::Instruction &inst : *bb) {
+            reach(&inst, 0);
+        }
+    }
+
+    while (!queue.empty()) {
+        Entry entry = queue.top();
+        queue.pop();
+        uint64_t d = entry.first;
+        llvm::Instruction *inst = entry.second;
+        if (distance[inst] != d) {
+            continue; // we got here on a shorter path since
+        }
+
+        llvm::Instruction *prev = inst->getPrevNode();
+        if (prev == nullptr) {
+            // the first instruction of a BB comes after the terminators of its predecessors
+            llvm::BasicBlock *bb = inst->getParent();
+            for (llvm::BasicBlock *pbb : llvm::predecessors(bb)) {
+                reach(pbb->getTerminator(), d + 1);
+            }
 
-                    mainBBIter++;
-                    cmpBBIter++;
+            // and the entry of a function after the call sites which may call it
+            if (bb == &bb->getParent()->getEntryBlock()) {
+                for (unsigned site : calledFrom[funcIndex.at(bb->getParent())]) {
+                    reach(callSites[site].cb, d + 1 + PatchDistanceCallCost);
                 }
+            }
+            continue;
+        }
 
-                // if there are more instructions in cmpBB, they aren't equivalent
-                if(cmpBBIter != cmpBB.instructionsWithoutDebug().end()) {
-                    foundEquiv = false;
+        // after a call, we get here by returning from a callee with a body, or straight from the call otherwise
+        auto site = siteOf.find(prev);
+        bool direct = site == siteOf.end() || callSites[site->second].callees.empty();
+        if (site != siteOf.end()) {
+            for (unsigned callee : callSites[site->second].callees) {
+                if (funcs[callee]->empty()) {
+                    direct = true;
                 }
-                
-                if (foundEquiv) {
-                    bbEquivSets[&bb].insert(&cmpBB);
-                    bbweights[&bb] = 0;
-                    patchInstructions.erase(&bb);
-                    // break; // to next bb in mainFunc
+                for (llvm::Instruction *ret : returns[callee]) {
+                    reach(ret, d + 1);
                 }
             }
         }
+
+        if (direct) {
+            reach(prev, d + 1);
+        }
+    }
+
+    for (auto &entry : distance) {
+        priorities[entry.first] = std::numeric_limits<uint64_t>::max() - entry.second;
+    }
+}
+
+namespace klee {
+
+PatchExplorer::PatchExplorer(Executor *executor)
+    : mainModule(executor->kmodule->module.get()),
+      cmpModule(executor->cmpModule->module.get()) {
+    
+    pruning = executor->pruning;
+
+    // the analysis only depends on the two modules and the metric, so reuse it if we've done it before
+    std::string cacheFile;
+    if (!PatchPriorityCache.empty()) {
+        cacheFile = PatchPriorityCache + "/" + cacheKey() + ".priorities";
+    }
+
+    if (!cacheFile.empty() && loadPriorities(cacheFile)) {
+        klee_message("Using the patch priorities cached in %s", cacheFile.c_str());
+    } else {
+        computePriorities();
+        if (!cacheFile.empty()) {
+            storePriorities(cacheFile);
+        }
+    }
+
+    if (DumpPatchPriorities) {
+        dumpPriorities();
+    }
+}
+
+void PatchExplorer::computePriorities() {
+    // STEP 1: compute weights of BBs
+    std::unordered_map<llvm::BasicBlock *, int> bbweights;
+
+    // auto curr = mainModule->getFunction(executor->entryPoint)->getEntryBlock().getFirstNonPHIOrDbgOrLifetime();
+
+    // map of equivalence between BBs (patched -> original) for checking control flow
+    // use a set for the case of multiple equivalent blocks
+    std::unordered_map<llvm::BasicBlock *, std::unordered_set<llvm::BasicBlock *>> bbEquivSets;
+    
+    // every function is compared on its own, so we do them in parallel and merge the results
+    std::vector<llvm::Function *> funcs;
+    for (llvm::Function &func : *mainModule) {
+        funcs.push_back(&func);
+    }
+
+    std::vector<FunctionAnalysis> analyses(funcs.size());
+    forEachFunction(funcs, [&](size_t index) {
+        matchFunction(*funcs[index], cmpModule, analyses[index]);
+    });
+
+    for (FunctionAnalysis &res : analyses) {
+        bbweights.insert(res.bbweights.begin(), res.bbweights.end());
+        patchInstructions.insert(res.patchBlocks.begin(), res.patchBlocks.end());
+        bbEquivSets.insert(res.bbEquivSets.begin(), res.bbEquivSets.end());
+        res.bbweights.clear();
+        res.bbEquivSets.clear();
     }
 
     // next, now we need to make another pass through all the BBs with equivalences and check that their
@@ -322,7 +1202,7 @@ PatchExplorer::PatchExplorer(Executor *executor)
     // we'll map the computed weights to instructions as well, since we need the granularity for call sites
     std::unordered_map<llvm::Instruction *, int> instweights;
 
-    std::unordered_set<llvm::CallBase*> call_insts;
+    std::vector<llvm::CallBase*> call_insts;
 
     for (llvm::Function &f : *mainModule) {
         for (llvm::BasicBlock &b : f) {
@@ -342,10 +1222,7 @@ PatchExplorer::PatchExplorer(Executor *executor)
 
                 // store pointers to call sites
                 if (llvm::CallBase *cb = llvm::dyn_cast<llvm::CallBase>(&i)) {
-                    if (auto *ci = llvm::dyn_cast<llvm::CallInst>(cb)) {
-                        if (ci->isInlineAsm()) continue;
-                    } 
-                    call_insts.insert(cb);
+                    call_insts.push_back(cb);
                 }
             }
         }
@@ -353,247 +1230,280 @@ PatchExplorer::PatchExplorer(Executor *executor)
 
     // We also need to fill in the weights for function calls.
     // We'll just give a weight of one, prioritizes immediate instructions.
-    bool c = false;
-    do {
-        c = false;
-        for (llvm::CallBase *cb : call_insts) {
-            assert(cb && "callbase is nullptr!");
-            std::unordered_set<llvm::Function *> possibleFns;
-            // errs() << *cb << "\n";
-            auto *tmp = llvm::dyn_cast<llvm::CallBase>(cb->stripPointerCasts());
-            if (tmp) {
-                cb = tmp;
-            }
-            assert(cb && "could not strip!");
-            if (llvm::Function *f = getCallInstFunction(cb)) {
-                possibleFns.insert(f);
-            } else if (llvm::Function *f = cb->getCalledFunction()) {
-                possibleFns.insert(f);
-            } else if (auto *f = llvm::dyn_cast<llvm::Function>(cb->getCalledOperand()->stripPointerCasts())) {
-                possibleFns.insert(f);
-            } else if (llvm::GlobalAlias *ga = llvm::dyn_cast<llvm::GlobalAlias>(cb->getCalledOperand())) {
-                llvm::Function *f = llvm::dyn_cast<llvm::Function>(ga->getAliasee());
-                assert(f && "bad assumption about aliases!");
-                possibleFns.insert(f);
-            } else if (llvm::GlobalAlias *ga = llvm::dyn_cast<llvm::GlobalAlias>(cb->getCalledOperand()->stripPointerCasts())) {
-                llvm::Function *f = llvm::dyn_cast<llvm::Function>(ga->getAliasee());
-                assert(f && "bad assumption about aliases!");
-                possibleFns.insert(f);
-            } else {
-                // TODO: dealing with function pointers
-                // Edge case related to exit() function giving itself weight by calling a function pointer with same args
-                // results in weight propogating throughout program from exit (less accurate pruning).
-                // But we need this to deal with calls to function ptrs updated with weight in previous iters of this loop
-
-                if (!cb->isIndirectCall()) {
-                    assert(false && "FIXME"); // needs updating from Agamotto, but I don't use this
-                    // llvm::errs() << *cb << "\n";
-                    // llvm::errs() << cb->getCalledOperand() << "\n";
-                    // if (cb->getCalledOperand()) llvm::errs() << *cb->getCalledOperand() << "\n";
-                    // if (cb->getCalledOperand()) llvm::errs() << *cb->getCalledOperand()->stripPointerCastsNoFollowAliases() << "\n";
-                    // if (cb->getCalledOperand()) llvm::errs() << llvm::dyn_cast<llvm::GlobalAlias>(cb->getCalledOperand()->stripPointerCastsNoFollowAliases()) << "\n";
-                }
-                assert(cb->isIndirectCall());
-
-                for (llvm::Function &f : *mainModule) {
-                    for (unsigned i = 0; i < (unsigned)cb->arg_size(); ++i) {
-                        if (f.arg_size() <= i) {
-                            if (f.isVarArg()) {
-                                possibleFns.insert(&f);
-                            }
-                            break;
-                        }
-
-                        llvm::Argument *arg = f.arg_begin() + i;
-                        llvm::Value *val = cb->getArgOperand(i);
-
-                        if (arg->getType() != val->getType()) break;
-                        else if (i + 1 == cb->arg_size()) possibleFns.insert(&f);
-                    }
-                }
-            }
-
-            for (llvm::Function *f : possibleFns) {
-                for (llvm::BasicBlock &bb : *f) {
-                    for (llvm::Instruction &i : bb) {
-                        if (instweights[&i] && !instweights[llvm::dyn_cast<llvm::Instruction>(cb)]) {
-                            c = true;
-                            instweights[llvm::dyn_cast<llvm::Instruction>(cb)] = 1;
-                            goto done;
-                        }
-                    }
-                }
-            }
+    // Both this and boosting the priorities of callees below propagate along the call graph, so we build it
+    // once and condense it into its SCCs (i.e. the recursive functions), which we then visit in topological order.
+    std::unordered_map<llvm::Function *, unsigned> funcIndex;
+    for (unsigned f = 0; f < funcs.size(); ++f) {
+        funcIndex[funcs[f]] = f;
+    }
 
-            done: (void)0;
+    IndirectCallTargets indirectTargets(mainModule);
+    std::vector<CallSite> callSites;
+    std::vector<std::vector<unsigned>> calls(funcs.size()), calledFrom(funcs.size()), callees(funcs.size());
+    for (llvm::CallBase *cb : call_insts) {
+        std::unordered_set<llvm::Function *> possibleFns;
+        if (!cb->isInlineAsm()) {
+            possibleCallees(cb, indirectTargets, possibleFns);
         }
-    } while (c);
 
-    // Now we do the priorites
-
-    for (llvm::Function &f : *mainModule) {
-        if (f.empty()) continue;
-        llvm::DominatorTree dom(f);
-
-        // Find the ending basic blocks
-        std::unordered_set<llvm::BasicBlock*> endBlocks, bbSet, traversed;
-    
-        llvm::BasicBlock *entry = &f.getEntryBlock();
-        assert(entry);
-        bbSet.insert(entry);
-
-        while(bbSet.size()) {
-            llvm::BasicBlock *bb = *bbSet.begin();
-            assert(bb);
-            bbSet.erase(bbSet.begin());
-            traversed.insert(bb);
-
-            if (llvm::succ_empty(bb)) {
-                endBlocks.insert(bb);
-            } else {
-                for (llvm::BasicBlock *sbb : llvm::successors(bb)) {
-                    assert(sbb);
-                    if (traversed.count(sbb)) continue;
-                    if (!dom.dominates(sbb, bb)) bbSet.insert(sbb);
-                }
+        // functions passed to a call count as called by it as well, the callee may well call them
+        for (llvm::Value *arg : cb->args()) {
+            if (auto *f = llvm::dyn_cast<llvm::Function>(arg)) {
+                possibleFns.insert(f);
             }
         }
 
-        // errs() << "\tfound terminators" << "\n";
-        bbSet = endBlocks;
+        unsigned site = callSites.size();
+        callSites.push_back({cb, funcIndex.at(cb->getFunction()), {}});
+        for (llvm::Function *f : possibleFns) {
+            unsigned callee = funcIndex.at(f);
+            callSites[site].callees.push_back(callee);
+            calledFrom[callee].push_back(site);
+            callees[callSites[site].caller].push_back(callee);
+        }
+        calls[callSites[site].caller].push_back(site);
+    }
 
-        /**
-        * Propagating the priority is slightly trickier than just finding the 
-        * terminal basic blocks, as different paths can have different priorities.
-        * So, we annotate the propagated with the priority. If the priority changed,
-        * then reprop.
-        */
+    if (PatchPriorityMetric == PriorityMetric::Distance) {
+        distancePriorities(funcs, funcIndex, callSites, calledFrom, patchInstructions, priorities);
+        return;
+    }
 
-        std::unordered_map<llvm::BasicBlock*, uint64_t> prop;
+    std::vector<std::vector<unsigned>> sccs = stronglyConnectedComponents(callees);
 
-        while (bbSet.size()) {
-            llvm::BasicBlock *bb = *bbSet.begin();
-            assert(bb);
-            bbSet.erase(bbSet.begin());
+    // a function has weight if any of its instructions do or it may call a function which has weight,
+    // visiting callees first we know about all the functions an SCC calls by the time we get to it
+    std::vector<bool> hasWeight(funcs.size());
+    std::vector<unsigned> sccOf(funcs.size());
+    for (unsigned scc = 0; scc < sccs.size(); ++scc) {
+        bool weight = false;
+        for (unsigned f : sccs[scc]) {
+            sccOf[f] = scc;
+        }
 
-            llvm::Instruction *pi = bb->getTerminator();
-            if (!pi) {
-                assert(f.isDeclaration());
-                continue; // empty body
+        for (unsigned f : sccs[scc]) {
+            for (llvm::BasicBlock &bb : *funcs[f]) {
+                for (llvm::Instruction &i : bb) {
+                    weight = weight || instweights[&i];
+                }
             }
-
-            if (prop.count(bb) && prop[bb] == priorities[pi]) {
-                continue;
+            for (unsigned site : calls[f]) {
+                for (unsigned callee : callSites[site].callees) {
+                    weight = weight || (sccOf[callee] != scc && hasWeight[callee]);
+                }
             }
-            prop[bb] = priorities[pi];
+        }
 
-            llvm::Instruction *i = pi->getPrevNode();
-            while (i) {
-                priorities[i] = priorities[pi] + instweights[i];
-                pi = i;
-                i = pi->getPrevNode();
+        // the functions of an SCC all call each other, so they either all have weight or none do
+        for (unsigned f : sccs[scc]) {
+            hasWeight[f] = weight;
+        }
+    }
+
+    for (CallSite &site : callSites) {
+        for (unsigned callee : site.callees) {
+            if (hasWeight[callee]) {
+                instweights[site.cb] = 1;
+                break;
             }
+        }
+    }
 
-            for (llvm::BasicBlock *pbb : llvm::predecessors(bb)) {
-                assert(pbb);
-                
-                // if (!dom.dominates(bb, pbb)) bbSet.insert(pbb);
-                if (!prop.count(pbb)) bbSet.insert(pbb);
+    // Now we do the priorites
 
-                // this gives a more accurate propagation, but hangs on some functions
-                // bbSet.insert(pbb);
+    // the priorities within every function only depend on the weights, so these are done in parallel too
+    forEachFunction(funcs, [&](size_t index) {
+        if (!funcs[index]->empty()) {
+            propagateFunction(*funcs[index], instweights, analyses[index].priorities);
+        }
+    });
 
-                llvm::Instruction *term = pbb->getTerminator();
-                priorities[term] = std::max(priorities[term], 
-                                            instweights[term] + priorities[pi]); 
-            }
+    for (FunctionAnalysis &res : analyses) {
+        for (auto &p : res.priorities) {
+            priorities[p.first] = p.second;
         }
     }
 
     /**
     * We're actually still not done. For each function, the base priority needs to
     * be boosted by the priority of the call site return locations.
+    * Every instruction without a priority gets the highest priority of the return locations of the
+    * call sites which may call its function. We visit the SCCs callers first, so the return locations
+    * have been boosted already, except within the SCC where we repeat until nothing changes.
     */
-    bool changed = false;
-    do {
-        changed = false;
-        for (llvm::Function &f : *mainModule) {
-            if (f.empty()) continue;
-            for (llvm::Use &u : f.uses()) {
-                llvm::User *usr = u.getUser();
-                // errs() << "usr:" << *usr << "\n";
-                if (auto *cb = llvm::dyn_cast<llvm::CallBase>(usr)) {
-                    // errs() << "\t=> " << priorities[i] << "\n";
-                    llvm::Instruction *retLoc = getReturnLocation(cb);
+    std::vector<uint64_t> boost(funcs.size());
+    for (auto scc = sccs.rbegin(); scc != sccs.rend(); ++scc) {
+        bool changed = false;
+        do {
+            changed = false;
+            for (unsigned f : *scc) {
+                for (unsigned site : calledFrom[f]) {
+                    llvm::Instruction *retLoc = getReturnLocation(callSites[site].cb);
                     assert(retLoc);
-                    // errs() << "\t=> " << priorities[retLoc] << "\n";
-                    if (priorities[retLoc]) {
-                        for (llvm::BasicBlock &bb : f) {
-                            for (llvm::Instruction &ii : bb) {
-                                if (!priorities[&ii]) {
-                                    changed = true;
-                                    priorities[&ii] = priorities[retLoc];
-                                }
-                            }
-                        }
+
+                    uint64_t p = priorities[retLoc] ? priorities[retLoc] : boost[callSites[site].caller];
+                    if (p > boost[f]) {
+                        changed = true;
+                        boost[f] = p;
+                    }
+                }
+            }
+        } while (changed);
+
+        for (unsigned f : *scc) {
+            if (!boost[f]) continue;
+            for (llvm::BasicBlock &bb : *funcs[f]) {
+                for (llvm::Instruction &ii : bb) {
+                    if (!priorities[&ii]) {
+                        priorities[&ii] = boost[f];
                     }
                 }
             }
         }
+    }
 
-        for (llvm::CallBase *cb : call_insts) {
-            llvm::Instruction *retLoc = getReturnLocation(cb);
-            assert(retLoc);
+    // dumpPriorities();
+}
 
-            std::unordered_set<llvm::Function*> possibleFns;
-            if (llvm::Function *f = getCallInstFunction(cb)) {
-                possibleFns.insert(f);
-            } else if (llvm::Function *f = cb->getCalledFunction()) {
-                possibleFns.insert(f);
-            } else if (llvm::GlobalAlias *ga = llvm::dyn_cast<llvm::GlobalAlias>(cb->getCalledOperand())) {
-                llvm::Function *f = llvm::dyn_cast<llvm::Function>(ga->getAliasee());
-                assert(f && "bad assumption about aliases!");
-                possibleFns.insert(f);
-            } else if (llvm::GlobalAlias *ga = llvm::dyn_cast<llvm::GlobalAlias>(cb->getCalledOperand()->stripPointerCasts())) {
-                llvm::Function *f = llvm::dyn_cast<llvm::Function>(ga->getAliasee());
-                assert(f && "bad assumption about aliases!");
-                possibleFns.insert(f);
-            } else {
-                if (!cb->isIndirectCall()) llvm::errs() << *cb << "\n";
-                assert(cb->isIndirectCall());
-
-                for (llvm::Function &f : *mainModule) {
-                    for (unsigned i = 0; i < (unsigned)cb->arg_size(); ++i) {
-                        if (f.arg_size() <= i) {
-                            if (f.isVarArg()) {
-                                possibleFns.insert(&f);
-                            }
-                            break;
-                        }
-
-                        llvm::Argument *arg = f.arg_begin() + i;
-                        llvm::Value *val = cb->getArgOperand(i);
-
-                        if (arg->getType() != val->getType()) break;
-                        else if (i + 1 == cb->arg_size()) possibleFns.insert(&f);
-                    }
-                }
+// the cache file is the header followed by the priority of every instruction and then whether every BB is patch
+// code, both in the order we iterate over the module
+struct PriorityCacheHeader {
+    char magic[8];
+    uint64_t numInstructions;
+    uint64_t numBlocks;
+};
+
+static const char priorityCacheMagic[8] = {'K', 'C', 'M', 'P', 'P', 'R', 'I', '1'};
+
+// the version of the analysis which computed the priorities, goes in the cache key so priorities cached by an
+// earlier build aren't used. Bump it whenever a change to the analysis changes the priorities it computes:
+//   2: block addresses and phi incoming blocks are compared by the block they refer to
+//   3: atomic orderings, syncscopes and call properties are compared
+//   4: blocks whose phis take their values from other blocks are patch code
+//   5: indirect calls may call the functions whose address is bitcast to their type
+static const unsigned priorityAnalysisVersion = 5;
+
+std::string PatchExplorer::cacheKey() {
+    // hash the modules as bitcode, anything which changes them (e.g. the options they were prepared with)
+    // changes the key
+    uint64_t hashes[2];
+    llvm::Module *modules[2] = { mainModule, cmpModule };
+
+    for (int m = 0; m < 2; ++m) {
+        llvm::SmallVector<char, 0> bitcode;
+        llvm::raw_svector_ostream os(bitcode);
+        llvm::WriteBitcodeToFile(*modules[m], os);
+        hashes[m] = llvm::xxHash64(llvm::StringRef(bitcode.data(), bitcode.size()));
+    }
+
+    unsigned version = PatchPriorityCacheVersion ? PatchPriorityCacheVersion : priorityAnalysisVersion;
+    char key[48];
+    snprintf(key, sizeof(key), "%016llx%016llx-v%u", (unsigned long long) hashes[0], (unsigned long long) hashes[1],
+             version);
+
+    // as do the options of the metric
+    if (PatchPriorityMetric == PriorityMetric::Distance) {
+        return std::string(key) + "-distance-" + std::to_string(PatchDistanceCallCost);
+    }
+    return key;
+}
+
+bool PatchExplorer::loadPriorities(const std::string &path) {
+    // large files are mapped rather than read
+    auto buffer = llvm::MemoryBuffer::getFile(path, /*IsText=*/false, /*RequiresNullTerminator=*/false);
+    if (!buffer) {
+        return false;
+    }
+
+    const char *data = (*buffer)->getBufferStart();
+    size_t size = (*buffer)->getBufferSize();
+
+    PriorityCacheHeader header;
+    if (size < sizeof(header)) {
+        return false;
+    }
+    memcpy(&header, data, sizeof(header));
+
+    uint64_t numInstructions = mainModule->getInstructionCount();
+    uint64_t numBlocks = 0;
+    for (llvm::Function &func : *mainModule) {
+        numBlocks += func.size();
+    }
+
+    if (memcmp(header.magic, priorityCacheMagic, sizeof(header.magic)) != 0 ||
+        header.numInstructions != numInstructions || header.numBlocks != numBlocks ||
+        size != sizeof(header) + numInstructions * sizeof(uint64_t) + numBlocks) {
+        klee_warning("ignoring invalid patch priority cache %s", path.c_str());
+        return false;
+    }
+
+    const char *prio = data + sizeof(header);
+    const char *patch = prio + numInstructions * sizeof(uint64_t);
+    priorities.reserve(numInstructions);
+
+    for (llvm::Function &func : *mainModule) {
+        for (llvm::BasicBlock &bb : func) {
+            if (*patch++) {
+                patchInstructions.insert(&bb);
             }
 
-            for (llvm::Function *f : possibleFns) {
-                for (llvm::BasicBlock &bb : *f) {
-                    for (llvm::Instruction &i : bb) {
-                        if (!priorities[&i] && priorities[retLoc]) {
-                            changed = true;
-                            priorities[&i] = priorities[retLoc];
-                        }
-                    }
-                }
+            for (llvm::Instruction &inst : bb) {
+                uint64_t p;
+                memcpy(&p, prio, sizeof(p));
+                prio += sizeof(p);
+                priorities[&inst] = p;
             }
         }
-    } while (changed);
+    }
 
-    // dumpPriorities();
+    return true;
+}
+
+void PatchExplorer::storePriorities(const std::string &path) {
+    std::error_code ec = llvm::sys::fs::create_directories(llvm::sys::path::parent_path(path));
+    if (ec) {
+        klee_warning("could not create patch priority cache for %s: %s", path.c_str(), ec.message().c_str());
+        return;
+    }
+
+    std::string prio, patch;
+    for (llvm::Function &func : *mainModule) {
+        for (llvm::BasicBlock &bb : func) {
+            patch.push_back(patchInstructions.count(&bb) ? 1 : 0);
+
+            for (llvm::Instruction &inst : bb) {
+                uint64_t p = getPriority(&inst);
+                prio.append(reinterpret_cast<const char *>(&p), sizeof(p));
+            }
+        }
+    }
+
+    PriorityCacheHeader header;
+    memcpy(header.magic, priorityCacheMagic, sizeof(header.magic));
+    header.numInstructions = prio.size() / sizeof(uint64_t);
+    header.numBlocks = patch.size();
+
+    // other runs may be storing the same file, so write it aside and move it in place in one go
+    std::string tmp = path + "." + std::to_string(llvm::sys::Process::getProcessId());
+    {
+        llvm::raw_fd_ostream os(tmp, ec);
+        if (ec) {
+            klee_warning("could not write patch priority cache %s: %s", tmp.c_str(), ec.message().c_str());
+            return;
+        }
+        os.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        os << prio << patch;
+        os.close();
+        if (os.has_error()) {
+            os.clear_error();
+            llvm::sys::fs::remove(tmp);
+            return;
+        }
+    }
+
+    if (llvm::sys::fs::rename(tmp, path)) {
+        llvm::sys::fs::remove(tmp);
+    }
 }
 
 uint64_t PatchExplorer::getPriority(llvm::Instruction *inst) {
@@ -611,12 +1521,14 @@ void PatchExplorer::dumpPriorities() {
         bool printedFunc = false;
 
         for (llvm::BasicBlock &bb : func) {
+            // patch code is printed even if it has no priority, e.g. a block which only returns
             bool printedBB = false;
+            bool patch = patchInstructions.count(&bb) > 0;
 
             for (llvm::Instruction &inst : bb) {
-                auto p = priorities[&inst];
+                auto p = getPriority(&inst);
 
-                if (p != 0) {
+                if (p != 0 || patch) {
                     if (!printedFunc) {
                         llvm::errs() << "Function: " << func.getName().str() << "\n";
                         printedFunc = true;
@@ -625,7 +1537,7 @@ void PatchExplorer::dumpPriorities() {
                     if (!printedBB) {
                         llvm::errs() << "\tBB: ";
                         bb.printAsOperand(llvm::errs(), false);
-                        llvm::errs() << "\n";
+                        llvm::errs() << (patch ? " (patch)" : "") << "\n";
                         printedBB = true;
                     }
 
@@ -4,6 +4,8 @@
 #include "Executor.h"
 #include "llvm/IR/Module.h"
 
+#include <string>
+
 namespace klee {
 
 // This class takes the LLVM diff file and generates the priorities to direct execution  
@@ -31,7 +33,7 @@ public:
     // does this by checking if parent BB is in patchInstructions set
     bool isPatchCode(llvm::Instruction *inst);
 
-    // print all non-zero priorities to llvm::errs() for debugging
+    // print all non-zero priorities and the patch code to llvm::errs(), for --dump-patch-priorities
     void dumpPriorities();
 
     // print out the entire program for debugging purposes
@@ -39,6 +41,18 @@ public:
 
 private:
 
+    // the analysis, fills in priorities and patchInstructions
+    void computePriorities();
+
+    // the name of the cache file for this pair of modules, hashes both of them
+    std::string cacheKey();
+
+    // load the results of the analysis from the cache, returns false if it's missing or invalid
+    bool loadPriorities(const std::string &path);
+
+    // store the results of the analysis in the cache
+    void storePriorities(const std::string &path);
+
     // priorities, should be access through get_priority function
     std::unordered_map<llvm::Instruction *, uint64_t> priorities;
 
@@ -32,6 +32,7 @@
 
 #include <cassert>
 #include <cmath>
+#include <tuple>
 
 using namespace klee;
 using namespace llvm;
@@ -556,64 +557,60 @@ void InterleavedSearcher::printName(llvm::raw_ostream &os) {
 ///
 
 bool PatchPriority::StatePriority::operator<(const PatchPriority::StatePriority &other) const {
-  // first, prioritize any states which have run patch code already
-  if (state->ranPatchedCode && !other.state->ranPatchedCode) {
-    return false;
-  } else if (!state->ranPatchedCode && other.state->ranPatchedCode) {
-    return true;
-  }
-
-  // now we use priorities to sort
-  bool youngerState = state->steppedInstructions < other.state->steppedInstructions;
-  bool lowerPriority = priority < other.priority;
-  bool equalPriority = priority == other.priority; 
-
-  if (lowerPriority) {
-    return true;
-  } else if (equalPriority && youngerState) {
-    return true;
-  }
-  
-  return false;
-};
+  return std::tie(ranPatchedCode, priority, steppedInstructions) <
+         std::tie(other.ranPatchedCode, other.priority, other.steppedInstructions);
+}
 
-PatchPriority::PatchPriority(Executor *executor) {
+PatchPriority::PatchPriority(Executor *executor) : executor(executor) {
   // initialize the patch explorer object which computes the priorities we'll use
   patchExplorer = new PatchExplorer(executor);
+
+  // we're the ones who mark states that ran patched code, so the test cases can record it
+  executor->tracksPatchedCode = true;
 }
 
 PatchPriority::~PatchPriority() {
   delete patchExplorer;
 }
 
-ExecutionState* PatchPriority::filterState(ExecutionState *execState) {
-  const auto iter = removed.find(execState);
-  if (iter != removed.end()) {
-    removed.erase(iter);
-    return nullptr;
-  }
+void PatchPriority::buildInstructionPriorities() {
+  instructionPriorities.resize(executor->kmodule->infos->getMaxID(), InstructionPriority{0, false});
 
-  return execState;
+  for (auto &kf : executor->kmodule->functions) {
+    for (unsigned i = 0; i < kf->numInstructions; ++i) {
+      KInstruction *ki = kf->instructions[i];
+      instructionPriorities[ki->info->id] = {patchExplorer->getPriority(ki->inst),
+                                             patchExplorer->isPatchCode(ki->inst)};
+    }
+  }
 }
 
 void PatchPriority::addState(ExecutionState *current, ExecutionState *execState) {
+  if (instructionPriorities.empty()) {
+    buildInstructionPriorities();
+  }
+  const InstructionPriority &ip = instructionPriorities[execState->pc->info->id];
+
   // if the previous state we got here from ran patched code or this state will run patch code, mark it
   if (current && current->ranPatchedCode) {
     execState->ranPatchedCode = true;
   }
 
-  if (patchExplorer->isPatchCode(execState->pc->inst)) {
+  if (ip.patchCode) {
     // llvm::errs() << "Ran patched code: " << *(execState->pc->inst) << "\n";
     execState->ranPatchedCode = true;
   }
 
-  uint64_t priority = patchExplorer->getPriority(execState->pc->inst);
+  uint64_t priority = ip.priority;
 
   // we prune paths if they are the result of branch/call, have 0 priority (i.e. will not reach patched
   // code) AND we have not previously run patched code up to this state
   if (patchExplorer->pruning && !execState->ranPatchedCode) {
     if (isa<llvm::CallInst>(execState->prevPC->inst) || isa<llvm::BranchInst>(execState->prevPC->inst)) {
       if (priority == 0) {
+        if (states.contains(execState)) {
+          states.remove(execState);
+        }
         return;
       }
     }
@@ -621,26 +618,23 @@ void PatchPriority::addState(ExecutionState *current, ExecutionState *execState)
 
   // llvm::errs() << "*** Added state w/ priorities: " << priority << "\n";
 
-  states.emplace(execState, priority);
+  StatePriority key{execState->ranPatchedCode, priority, execState->steppedInstructions};
+  if (states.contains(execState)) {
+    states.update(execState, key);
+  } else {
+    states.push(execState, key);
+  }
 }
 
 ExecutionState &PatchPriority::selectState() {
-  int64_t priority = 0;
-  do {
-    const auto &sp = states.top();
-    lastState = filterState(sp.state);
-    priority = sp.priority;
-    states.pop();
-  } while (!lastState);
-
-  // llvm::errs() << "*** Selected state with priority: " << priority << "\n";
-  return *lastState;
+  // llvm::errs() << "*** Selected state with priority: " << states.topKey().priority << "\n";
+  return *states.top();
 }
 
 void PatchPriority::update(ExecutionState *current,
                          const std::vector<ExecutionState *> &addedStates,
                          const std::vector<ExecutionState *> &removedStates) {
-  // reinsert current
+  // update the key of current, it stays in the heap
   if (current) {
     addState(nullptr, current);
   }
@@ -652,8 +646,10 @@ void PatchPriority::update(ExecutionState *current,
 
   // remove states
   for (ExecutionState *execState : removedStates) {
-    removed.insert(execState);
-    // llvm::errs() << "*** Removed state w/ priorities: " << sp->priority << "\n";
+    // it may have been pruned already
+    if (states.contains(execState)) {
+      states.remove(execState);
+    }
   }
 }
 
@@ -667,6 +663,22 @@ bool PatchPriority::done() {
   return states.empty();
 }
 
+// the same check as the pruning in addState, for the first instruction of the target
+bool PatchPriority::prunesBranchTo(const ExecutionState &state, llvm::BasicBlock *target) {
+  if (!patchExplorer->pruning || state.ranPatchedCode) {
+    return false;
+  }
+
+  if (instructionPriorities.empty()) {
+    buildInstructionPriorities();
+  }
+  KFunction *kf = state.stack.back().kf;
+  KInstruction *ki = kf->instructions[kf->basicBlockEntry[target]];
+  const InstructionPriority &ip = instructionPriorities[ki->info->id];
+
+  return ip.priority == 0 && !ip.patchCode;
+}
+
 void PatchPriority::printName(llvm::raw_ostream &os) {
   os << "PatchPriority\n";
 }
@@ -14,6 +14,7 @@
 #include "Executor.h"
 #include "PTree.h"
 #include "PatchExplorer.h"
+#include "klee/ADT/IndexedHeap.h"
 #include "klee/ADT/RNG.h"
 #include "klee/System/Time.h"
 
@@ -62,6 +63,10 @@ namespace klee {
     // I don't know where else the empty() function is used, so I'll just add this here
     virtual bool done() { return false; }
 
+    // Musa: whether the searcher would drop the state right away if it took a branch to target,
+    // the executor asks before forking so it doesn't fork (or query the solver) for nothing
+    virtual bool prunesBranchTo(const ExecutionState &state, llvm::BasicBlock *target) { return false; }
+
     /// Prints name of searcher as a `klee_message()`.
     // TODO: could probably made prettier or more flexible
     virtual void printName(llvm::raw_ostream &os) = 0;
@@ -320,29 +325,41 @@ namespace klee {
   /// program, as an addition for Klee-Compare.
   class PatchPriority final : public Searcher {
   private:
-    // based on Agamotto's searcher, used by a priority queue
+    // based on Agamotto's searcher, the key of a state in the heap
     // https://github.com/efeslab/agamotto/blob/artifact-eval-osdi20/lib/Core/Searcher.h
     struct StatePriority {
-      ExecutionState *state;
+      bool ranPatchedCode;
       uint64_t priority;
+      uint64_t steppedInstructions;
 
-      StatePriority(ExecutionState *s, uint64_t p) : state(s), priority(p) {}
-
-      // Determine if LHS < RHS. To break ties, newer states have lower priority.
+      // Determine if LHS < RHS: first prioritize states which have run patch code,
+      // then by priority, and to break ties, newer states have lower priority.
       bool operator<(const StatePriority &other) const;
     };
 
+    struct StateHeapIndex {
+      std::size_t &operator()(ExecutionState *es) const { return es->patchHeapIndex; }
+    };
+
+    // what the patch explorer computed for an instruction
+    struct InstructionPriority {
+      uint64_t priority;
+      bool patchCode;
+    };
+
+    Executor *executor;
     PatchExplorer *patchExplorer;
-    ExecutionState *lastState;
 
-    // using a set instead of stl priority_queue because this gives us random element deletion
-    std::priority_queue<StatePriority> states;
+    // priorities of all instructions, indexed by the id of their InstructionInfo so that looking
+    // one up on every step is a single load rather than hashing into the patch explorer's maps
+    // filled in on first use, because the ids are only assigned once the module is manifested
+    std::vector<InstructionPriority> instructionPriorities;
 
-    // lazy state removal
-    std::unordered_set<ExecutionState*> removed;
+    // the states we may still explore, removed states and pruned states are taken out right away
+    IndexedHeap<ExecutionState *, StatePriority, StateHeapIndex> states;
 
-    ExecutionState* filterState(ExecutionState *execState);
     void addState(ExecutionState *current, ExecutionState *execState);
+    void buildInstructionPriorities();
 
   public:
     PatchPriority(Executor *executor);
@@ -353,6 +370,7 @@ namespace klee {
                 const std::vector<ExecutionState *> &removedStates) override;
     bool empty() override;
     bool done() override;
+    bool prunesBranchTo(const ExecutionState &state, llvm::BasicBlock *target) override;
     void printName(llvm::raw_ostream &os) override;
   };
 
@@ -408,41 +408,143 @@ ssize_t read(int fd, void *buf, size_t count) {
 
 // TODO: check for errors in these calls as well!
 
+// Capture channel for klee-compare. The outputs are appended to the native file descriptor
+// named by KLEE_COMPARE_FD, which klee-compare hands down to KLEE. Without it, they go to the
+// file named by KLEE_COMPARE_DUMP, or /tmp/klee_compare_dump.txt if that is not set either.
+// Every call is written out with a single native write right away, not buffered until exit,
+// so the outputs survive replays which end in _exit, abort, a failed assert or a KLEE error.
+#define KCMP_BUFFER_SIZE 4096
+
+// On the KLEE_COMPARE_FD channel every call is written as a record: a one byte call id and
+// the length of the data as four native-endian bytes, followed by the data itself. This lets
+// klee-compare tell which call produced a difference. The ids have to match the ones in
+// tools/klee-compare/OutputCompare.cpp. The dump files stay plain text.
+#define KCMP_HEADER_SIZE 5
+
+enum {
+  KCMP_PRINTF = 1,
+  KCMP_PUTCHAR,
+  KCMP_FPUTS,
+  KCMP_VFPRINTF,
+  KCMP_FPRINTF,
+  KCMP_FPUTC,
+  KCMP_FWRITE,
+  KCMP_WRITE
+};
+
+// scratch space to put a record together in, so it takes one write
+static char __kcmp_buffer[KCMP_BUFFER_SIZE];
+static int __kcmp_fd = -1;
+static int __kcmp_framed = 0;
+
+static void __kcmp_write(const char *data, size_t count) {
+  while (count > 0) {
+    ssize_t r = syscall(__NR_write, __kcmp_fd, data, count);
+    if (r <= 0)
+      return;
+    data += r;
+    count -= r;
+  }
+}
+
+static int __kcmp_open(void) {
+  if (__kcmp_fd < 0) {
+    const char *fd = getenv("KLEE_COMPARE_FD");
+    if (fd) {
+      __kcmp_fd = atoi(fd);
+      __kcmp_framed = 1;
+    } else {
+      const char *path = getenv("KLEE_COMPARE_DUMP");
+      if (!path)
+        path = "/tmp/klee_compare_dump.txt";
+      __kcmp_fd = syscall(__NR_open, path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    }
+  }
+  return __kcmp_fd;
+}
+
+static void __kcmp_header(char *header, int call, size_t count) {
+  uint32_t length = count;
+  header[0] = call;
+  memcpy(header + 1, &length, sizeof(length));
+}
+
+static void __kcmp_record(int call, const void *data, size_t count) {
+  size_t header = 0;
+
+  if (__kcmp_open() < 0)
+    return;
+
+  if (__kcmp_framed) {
+    header = KCMP_HEADER_SIZE;
+    __kcmp_header(__kcmp_buffer, call, count);
+  }
+
+  // too big to put together, the data goes straight through after the header
+  if (count > KCMP_BUFFER_SIZE - header) {
+    __kcmp_write(__kcmp_buffer, header);
+    __kcmp_write(data, count);
+    return;
+  }
+
+  memcpy(__kcmp_buffer + header, data, count);
+  __kcmp_write(__kcmp_buffer, header + count);
+}
+
+static void __kcmp_vprintf(int call, const char *fmt, va_list args) {
+  va_list copy;
+  size_t header = 0;
+  int n;
+  char *formatted;
+
+  if (__kcmp_open() < 0)
+    return;
+
+  // try to format straight into the scratch space first, leaving room for the header
+  if (__kcmp_framed)
+    header = KCMP_HEADER_SIZE;
+  va_copy(copy, args);
+  n = vsnprintf(__kcmp_buffer + header, KCMP_BUFFER_SIZE - header, fmt, copy);
+  va_end(copy);
+  if (n < 0)
+    return;
+  if ((size_t) n < KCMP_BUFFER_SIZE - header) {
+    if (header)
+      __kcmp_header(__kcmp_buffer, call, n);
+    __kcmp_write(__kcmp_buffer, header + n);
+    return;
+  }
+
+  // it didn't fit, format it on its own
+  formatted = malloc(n + 1);
+  if (!formatted)
+    return;
+  vsnprintf(formatted, n + 1, fmt, args);
+  __kcmp_record(call, formatted, n);
+  free(formatted);
+}
+
 // Don't use this unless it's the concrete exeuction of KLEE
 int kcmp_printf(const char *fmt, ...) {
   va_list args;
-  va_start(args, fmt);
+  int r;
 
-  // dump the print to a file
-  FILE *dumpfd = fopen("/tmp/klee_compare_dump.txt", "a+");
-  vfprintf(dumpfd, fmt, args);
-  fclose(dumpfd);
+  // dump the print to the capture
+  va_start(args, fmt);
+  __kcmp_vprintf(KCMP_PRINTF, fmt, args);
+  va_end(args);
 
   // let the print go through to the terminal
-  vprintf(fmt, args);
-
-  // TODO: this breaks things. using hardcoded path above instead
-  // use an env var from KLEE to output to KLEE's output dir
-  // char path[128]; // just hardcode some max lenght for the file path
-  // strcpy(path, getenv("KLEE_OUTPUT_PATH"));
-  // strcat(path, "/write_dump.txt");
-  
-  // TODO: this if statement should check if the getenv failed
-  // if (1) {
-  //   FILE *dumpfd = fopen(path, "a+");
-  //   vfprintf(dumpfd, fmt, args);
-  //   fclose(dumpfd);
-  // }
-
+  va_start(args, fmt);
+  r = vprintf(fmt, args);
   va_end(args);
-  return 0;
+  return r;
 }
 
 int kcmp_putchar(int c) {
-  // dump the string to the file
-  FILE *dumpfd = fopen("/tmp/klee_compare_dump.txt", "a+");
-  fputc(c, dumpfd);
-  fclose(dumpfd);
+  // dump the char to the capture
+  char ch = c;
+  __kcmp_record(KCMP_PUTCHAR, &ch, 1);
 
   // and to the original stream
   // should preserve any error return values to original caller
@@ -450,10 +552,8 @@ int kcmp_putchar(int c) {
 }
 
 int kcmp_fputs(const char *str, FILE *stream) {
-  // dump the string to the file
-  FILE *dumpfd = fopen("/tmp/klee_compare_dump.txt", "a+");
-  fputs(str, dumpfd);
-  fclose(dumpfd);
+  // dump the string to the capture
+  __kcmp_record(KCMP_FPUTS, str, strlen(str));
 
   // and to the original stream
   // should preserve any error return values to original caller
@@ -469,43 +569,47 @@ int kcmp_fputs_unlocked(const char *str, FILE *stream) {
   return kcmp_fputs(str, stream);
 }
 
+int kcmp_vfprintf (FILE * stream, const char *fmt, va_list args) {
+  va_list copy;
+
+  // dump to the capture
+  va_copy(copy, args);
+  __kcmp_vprintf(KCMP_VFPRINTF, fmt, copy);
+  va_end(copy);
+
+  // and to the original stream
+  return vfprintf(stream, fmt, args);
+}
+
 int kcmp_fprintf(FILE *stream, const char *format, ...) {
   va_list args;
-  va_start(args, format);
+  int r;
 
-  int r = kcmp_vfprintf(stream, format, args);
+  // dump to the capture
+  va_start(args, format);
+  __kcmp_vprintf(KCMP_FPRINTF, format, args);
   va_end(args);
 
   // and to the original stream
   // should preserve any error return values to original caller
+  va_start(args, format);
+  r = vfprintf(stream, format, args);
+  va_end(args);
   return r;
 }
 
 int kcmp_fputc(int chr, FILE *stream) {
-  // dump the char to the file
-  FILE *dumpfd = fopen("/tmp/klee_compare_dump.txt", "a+");
-  fputc(chr, dumpfd);
-  fclose(dumpfd);
+  // dump the char to the capture
+  char ch = chr;
+  __kcmp_record(KCMP_FPUTC, &ch, 1);
 
   // and to the original stream
   return fputc(chr, stream);
 }
 
-int kcmp_vfprintf (FILE * stream, const char *fmt, va_list args) {
-  // dump to the output file
-  FILE *dumpfd = fopen("/tmp/klee_compare_dump.txt", "a+");
-  vfprintf(dumpfd, fmt, args);
-  fclose(dumpfd);
-
-  // and to the original stream
-  return vfprintf(stream, fmt, args);
-}
-
 size_t kcmp_fwrite(const void *ptr, size_t size, size_t nmemb, FILE *stream) {
-  // dump to the output file
-  FILE *dumpfd = fopen("/tmp/klee_compare_dump.txt", "a+");
-  fwrite(ptr, size, nmemb, dumpfd);
-  fclose(dumpfd);
+  // dump to the capture
+  __kcmp_record(KCMP_FWRITE, ptr, size * nmemb);
 
   // and to the original stream
   return fwrite(ptr, size, nmemb, stream);
@@ -513,10 +617,8 @@ size_t kcmp_fwrite(const void *ptr, size_t size, size_t nmemb, FILE *stream) {
 }
 
 ssize_t kcmp_write(int fd, const void *buf, size_t count) {
-  // dump to the output file
-  FILE *dumpfd = fopen("/tmp/klee_compare_dump.txt", "a+");
-  fwrite(buf, count, 1, dumpfd);
-  fclose(dumpfd);
+  // dump to the capture
+  __kcmp_record(KCMP_WRITE, buf, count);
 
   // and to the original stream
   return write(fd, buf, count);
@@ -0,0 +1,38 @@
+// RUN: %clang %s -emit-llvm %O0opt -c -o %t.bc
+// RUN: rm -rf %t.klee-out
+// RUN: %klee --output-dir=%t.klee-out %t.bc
+
+// A concrete replay runs the test's path without the statistics, the process tree or the searcher
+// RUN: rm -rf %t.klee-out-concrete
+// RUN: %klee --output-dir=%t.klee-out-concrete --concrete-replay --replay-ktest-file=%t.klee-out/test000001.ktest %t.bc 2>&1 | FileCheck %s
+// RUN: test ! -f %t.klee-out-concrete/run.stats
+// RUN: test ! -f %t.klee-out-concrete/run.istats
+
+// A replay without the option keeps the statistics as usual
+// RUN: rm -rf %t.klee-out-replay
+// RUN: %klee --output-dir=%t.klee-out-replay --replay-ktest-file=%t.klee-out/test000001.ktest %t.bc 2>&1 | FileCheck %s
+// RUN: test -f %t.klee-out-replay/run.stats
+// RUN: test -f %t.klee-out-replay/run.istats
+
+// There is nothing to replay concretely without a ktest
+// RUN: rm -rf %t.klee-out-none
+// RUN: not %klee --output-dir=%t.klee-out-none --concrete-replay %t.bc 2>&1 | FileCheck --check-prefix=CHECK-NO-KTEST %s
+
+#include "klee/klee.h"
+
+#include <stdio.h>
+
+int main() {
+  int x;
+  klee_make_symbolic(&x, sizeof(x), "x");
+  klee_assume(x == 42);
+
+  printf("x is %d\n", x);
+  return 0;
+}
+
+// the program's output is buffered apart from KLEE's, so their order isn't fixed
+// CHECK-DAG: x is 42
+// CHECK-DAG: KLEE: done: completed paths = 1
+
+// CHECK-NO-KTEST: --concrete-replay requires a ktest to replay
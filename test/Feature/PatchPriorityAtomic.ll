@@ -0,0 +1,47 @@
+; Atomic read-modify-writes are compared by their operation. KLEE lowers atomics to plain loads and stores
+; before the analysis runs, so a change of only the ordering doesn't change what gets executed and isn't patch code.
+; RUN: sed -e 's/^;ORIG //' %s | %llvmas -o %t.orig.bc
+; RUN: sed -e 's/^;NEW //' %s | %llvmas -o %t.new.bc
+; RUN: rm -rf %t.klee-out
+; RUN: %klee --output-dir=%t.klee-out --search=patch-priority --compare-bitcode=%t.orig.bc --dump-patch-priorities %t.new.bc 2>&1 | FileCheck %s
+
+target datalayout = "e-p:64:64:64-i1:8:8-i8:8:8-i16:16:16-i32:32:32-i64:64:64-f32:32:32-f64:64:64-v64:64:64-v128:128:128-a0:0:64-s0:64:64-f80:128:128-n8:16:32:64"
+target triple = "x86_64-unknown-linux-gnu"
+
+@g = global i32 0, align 4
+
+define void @op() {
+entry:
+;ORIG   %old = atomicrmw add i32* @g, i32 1 seq_cst
+;NEW   %old = atomicrmw sub i32* @g, i32 1 seq_cst
+  ret void
+}
+
+define void @order() {
+entry:
+;ORIG   %old = atomicrmw add i32* @g, i32 1 monotonic
+;NEW   %old = atomicrmw add i32* @g, i32 1 seq_cst
+  ret void
+}
+
+define void @same() {
+entry:
+  %old = atomicrmw xchg i32* @g, i32 7 seq_cst
+  ret void
+}
+
+define i32 @main() {
+entry:
+  call void @op()
+  call void @order()
+  call void @same()
+  ret i32 0
+}
+
+; CHECK: Function: op
+; CHECK-NEXT: BB: %entry (patch)
+; CHECK-NOT: Function: order
+; CHECK-NOT: Function: same
+; CHECK: Function: main
+; CHECK-NEXT: BB: %entry
+; CHECK-NEXT: call void @op()
@@ -0,0 +1,50 @@
+; Block addresses are compared by the block they point to, so pointing one at another block is a change
+; RUN: sed -e 's/^;ORIG //' %s | %llvmas -o %t.orig.bc
+; RUN: sed -e 's/^;NEW //' %s | %llvmas -o %t.new.bc
+; RUN: rm -rf %t.klee-out
+; RUN: %klee --output-dir=%t.klee-out --search=patch-priority --compare-bitcode=%t.orig.bc --dump-patch-priorities %t.new.bc 2>&1 | FileCheck %s
+
+target datalayout = "e-p:64:64:64-i1:8:8-i8:8:8-i16:16:16-i32:32:32-i64:64:64-f32:32:32-f64:64:64-v64:64:64-v128:128:128-a0:0:64-s0:64:64-f80:128:128-n8:16:32:64"
+target triple = "x86_64-unknown-linux-gnu"
+
+@slot = global i8* null, align 8
+
+; unchanged, only runs once the patch has
+define void @same() {
+entry:
+  store i8* blockaddress(@jump, %two), i8** @slot, align 8
+  ret void
+}
+
+define void @arm() {
+entry:
+;ORIG   store i8* blockaddress(@jump, %one), i8** @slot, align 8
+;NEW   store i8* blockaddress(@jump, %two), i8** @slot, align 8
+  ret void
+}
+
+define i32 @jump() {
+entry:
+  %target = load i8*, i8** @slot, align 8
+  indirectbr i8* %target, [label %one, label %two]
+
+one:
+  ret i32 1
+
+two:
+  ret i32 2
+}
+
+define i32 @main() {
+entry:
+  call void @arm()
+  %r = call i32 @jump()
+  call void @same()
+  ret i32 0
+}
+
+; CHECK-NOT: Function: same
+; CHECK: Function: arm
+; CHECK-NEXT: BB: %entry (patch)
+; CHECK-NOT: Function: jump
+; CHECK: Function: main
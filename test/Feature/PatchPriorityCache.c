@@ -0,0 +1,46 @@
+// RUN: %clang %s -emit-llvm %O0opt -c -o %t.orig.bc
+// RUN: %clang %s -emit-llvm %O0opt -DPATCHED -c -o %t.patched.bc
+// RUN: rm -rf %t.cache && mkdir %t.cache
+
+// The first run computes the priorities and caches them, the second one uses them
+// RUN: rm -rf %t.klee-out
+// RUN: %klee --output-dir=%t.klee-out --search=patch-priority --compare-bitcode=%t.orig.bc --patch-priority-cache=%t.cache --dump-patch-priorities %t.patched.bc 2>&1 | FileCheck --check-prefix=CHECK-MISS %s
+// RUN: rm -rf %t.klee-out
+// RUN: %klee --output-dir=%t.klee-out --search=patch-priority --compare-bitcode=%t.orig.bc --patch-priority-cache=%t.cache --dump-patch-priorities %t.patched.bc 2>&1 | FileCheck --check-prefix=CHECK-HIT %s
+
+// Priorities cached by another version of the analysis aren't used, the ones of each version are kept apart
+// RUN: rm -rf %t.klee-out
+// RUN: %klee --output-dir=%t.klee-out --search=patch-priority --compare-bitcode=%t.orig.bc --patch-priority-cache=%t.cache --patch-priority-cache-version=1 --dump-patch-priorities %t.patched.bc 2>&1 | FileCheck --check-prefix=CHECK-MISS %s
+// RUN: rm -rf %t.klee-out
+// RUN: %klee --output-dir=%t.klee-out --search=patch-priority --compare-bitcode=%t.orig.bc --patch-priority-cache=%t.cache --patch-priority-cache-version=1 --dump-patch-priorities %t.patched.bc 2>&1 | FileCheck --check-prefix=CHECK-HIT-V1 %s
+// RUN: ls %t.cache | FileCheck --check-prefix=CHECK-FILES %s
+
+#include "klee/klee.h"
+
+int main() {
+  int x;
+  klee_make_symbolic(&x, sizeof(x), "x");
+
+#ifdef PATCHED
+  if (x == 5)
+    return 3;
+#endif
+
+  return 0;
+}
+
+// CHECK-MISS-NOT: Using the patch priorities cached
+// CHECK-MISS: Function: main
+// CHECK-MISS: BB: {{.*}} (patch)
+
+// CHECK-HIT: KLEE: Using the patch priorities cached in {{.*}}-v{{[0-9]+}}.priorities
+// CHECK-HIT: Function: main
+// CHECK-HIT: BB: {{.*}} (patch)
+
+// CHECK-HIT-V1: KLEE: Using the patch priorities cached in {{.*}}-v1.priorities
+// CHECK-HIT-V1: Function: main
+// CHECK-HIT-V1: BB: {{.*}} (patch)
+
+// CHECK-FILES: {{^[0-9a-f]+-v1\.priorities$}}
+// CHECK-FILES-NEXT: {{^[0-9a-f]+-v[0-9]+\.priorities$}}
+// CHECK-FILES-NOT: {{.}}
@@ -0,0 +1,62 @@
+; With the distance metric, an instruction's priority is the largest priority less the number of instructions
+; between it and the patch, and entering a call costs --patch-distance-call-cost more
+; RUN: sed -e 's/^;ORIG //' %s | %llvmas -o %t.orig.bc
+; RUN: sed -e 's/^;NEW //' %s | %llvmas -o %t.new.bc
+; RUN: rm -rf %t.klee-out
+; RUN: %klee --output-dir=%t.klee-out --search=patch-priority --patch-priority-metric=distance --compare-bitcode=%t.orig.bc --dump-patch-priorities %t.new.bc 2>&1 | FileCheck %s
+; RUN: rm -rf %t.klee-out
+; RUN: %klee --output-dir=%t.klee-out --search=patch-priority --patch-priority-metric=distance --patch-distance-call-cost=0 --compare-bitcode=%t.orig.bc --dump-patch-priorities %t.new.bc 2>&1 | FileCheck --check-prefix=CHECK-COST0 %s
+
+target datalayout = "e-p:64:64:64-i1:8:8-i8:8:8-i16:16:16-i32:32:32-i64:64:64-f32:32:32-f64:64:64-v64:64:64-v128:128:128-a0:0:64-s0:64:64-f80:128:128-n8:16:32:64"
+target triple = "x86_64-unknown-linux-gnu"
+
+@g = global i32 0, align 4
+@h = global i32 0, align 4
+
+define void @f() {
+entry:
+  %c = load volatile i32, i32* @g, align 4
+  %z = icmp eq i32 %c, 0
+  br i1 %z, label %p, label %q
+
+p:
+;ORIG   store volatile i32 1, i32* @h, align 4
+;NEW   store volatile i32 2, i32* @h, align 4
+  ret void
+
+q:
+  store volatile i32 3, i32* @g, align 4
+  ret void
+}
+
+; unchanged, only runs once the patch has
+define void @same() {
+entry:
+  store volatile i32 4, i32* @g, align 4
+  ret void
+}
+
+define i32 @main() {
+entry:
+  call void @f()
+  call void @same()
+  ret i32 0
+}
+
+; CHECK: Function: f
+; CHECK-NEXT: BB: %entry
+; CHECK-NEXT: [18446744073709551612]: {{.*}} load volatile
+; CHECK-NEXT: [18446744073709551613]: {{.*}} icmp
+; CHECK-NEXT: [18446744073709551614]: {{.*}} br
+; CHECK-NEXT: BB: %p (patch)
+; CHECK-NEXT: [18446744073709551615]: {{.*}} store volatile i32 2
+; CHECK-NOT: BB: %q
+; CHECK-NOT: Function: same
+; CHECK: Function: main
+; CHECK-NEXT: BB: %entry
+; CHECK-NEXT: [18446744073709551601]: {{.*}} call void @f()
+; CHECK-NOT: call void @same()
+
+; CHECK-COST0: Function: main
+; CHECK-COST0-NEXT: BB: %entry
+; CHECK-COST0-NEXT: [18446744073709551611]: {{.*}} call void @f()
@@ -0,0 +1,78 @@
+; Indirect calls may call the functions whose address is taken with the type of the call, or whose address is
+; bitcast to it
+; RUN: sed -e 's/^;ORIG //' %s | %llvmas -o %t.orig.bc
+; RUN: sed -e 's/^;NEW //' %s | %llvmas -o %t.new.bc
+; RUN: rm -rf %t.klee-out
+; RUN: %klee --output-dir=%t.klee-out --search=patch-priority --compare-bitcode=%t.orig.bc --dump-patch-priorities %t.new.bc 2>&1 | FileCheck %s
+
+target datalayout = "e-p:64:64:64-i1:8:8-i8:8:8-i16:16:16-i32:32:32-i64:64:64-f32:32:32-f64:64:64-v64:64:64-v128:128:128-a0:0:64-s0:64:64-f80:128:128-n8:16:32:64"
+target triple = "x86_64-unknown-linux-gnu"
+
+@g = global i32 0, align 4
+@fp = global i32 (i32)* @target, align 8
+@cast = global void (i8*)* bitcast (void (i32*)* @sink to void (i8*)*), align 8
+@other = global i64 (i64)* @same64, align 8
+
+define i32 @target(i32 %x) {
+entry:
+;NEW   store volatile i32 1, i32* @g, align 4
+  ret i32 %x
+}
+
+define void @sink(i32* %p) {
+entry:
+;NEW   store volatile i32 2, i32* %p, align 4
+  ret void
+}
+
+; the only function which may be called by viaOther, unchanged
+define i64 @same64(i64 %x) {
+entry:
+  store volatile i32 3, i32* @g, align 4
+  ret i64 %x
+}
+
+define i32 @viaPtr(i32 %x) {
+entry:
+  %f = load i32 (i32)*, i32 (i32)** @fp, align 8
+  %r = call i32 %f(i32 %x)
+  ret i32 %r
+}
+
+define void @viaCast() {
+entry:
+  %f = load void (i8*)*, void (i8*)** @cast, align 8
+  call void %f(i8* bitcast (i32* @g to i8*))
+  ret void
+}
+
+define i64 @viaOther(i64 %x) {
+entry:
+  %f = load i64 (i64)*, i64 (i64)** @other, align 8
+  %r = call i64 %f(i64 %x)
+  ret i64 %r
+}
+
+define i32 @main() {
+entry:
+  %r = call i32 @viaPtr(i32 1)
+  call void @viaCast()
+  %s = call i64 @viaOther(i64 1)
+  ret i32 0
+}
+
+; CHECK: Function: target
+; CHECK-NEXT: BB: %entry (patch)
+; CHECK: Function: sink
+; CHECK-NEXT: BB: %entry (patch)
+; CHECK-NOT: Function: same64
+; CHECK: Function: viaPtr
+; CHECK-NEXT: BB: %entry
+; CHECK-NEXT: load
+; CHECK-NEXT: call i32 %f
+; CHECK: Function: viaCast
+; CHECK-NEXT: BB: %entry
+; CHECK-NEXT: load
+; CHECK-NEXT: call void %f
+; CHECK-NOT: Function: viaOther
+; CHECK: Function: main
@@ -0,0 +1,63 @@
+; A phi which takes its values from other blocks than in the original makes its block patch code,
+; even though every instruction of the block is the same
+; RUN: sed -e 's/^;ORIG //' %s | %llvmas -o %t.orig.bc
+; RUN: sed -e 's/^;NEW //' %s | %llvmas -o %t.new.bc
+; RUN: rm -rf %t.klee-out
+; RUN: %klee --output-dir=%t.klee-out --search=patch-priority --compare-bitcode=%t.orig.bc --dump-patch-priorities %t.new.bc 2>&1 | FileCheck %s
+
+target datalayout = "e-p:64:64:64-i1:8:8-i8:8:8-i16:16:16-i32:32:32-i64:64:64-f32:32:32-f64:64:64-v64:64:64-v128:128:128-a0:0:64-s0:64:64-f80:128:128-n8:16:32:64"
+target triple = "x86_64-unknown-linux-gnu"
+
+@ga = global i32 0, align 4
+@gb = global i32 0, align 4
+
+define i32 @choose(i32 %x) {
+entry:
+  %c = icmp eq i32 %x, 0
+  br i1 %c, label %a, label %b
+
+a:
+  store volatile i32 1, i32* @ga, align 4
+  br label %join
+
+b:
+  store volatile i32 1, i32* @gb, align 4
+  br label %join
+
+join:
+;ORIG   %r = phi i32 [ 10, %a ], [ 20, %b ]
+;NEW   %r = phi i32 [ 10, %b ], [ 20, %a ]
+  ret i32 %r
+}
+
+; unchanged, only runs once the patch has
+define i32 @keep(i32 %x) {
+entry:
+  %c = icmp eq i32 %x, 0
+  br i1 %c, label %a, label %b
+
+a:
+  store volatile i32 2, i32* @ga, align 4
+  br label %join
+
+b:
+  store volatile i32 2, i32* @gb, align 4
+  br label %join
+
+join:
+  %r = phi i32 [ 10, %a ], [ 20, %b ]
+  ret i32 %r
+}
+
+define i32 @main() {
+entry:
+  %r = call i32 @choose(i32 0)
+  %s = call i32 @keep(i32 0)
+  ret i32 0
+}
+
+; CHECK: Function: choose
+; CHECK-NOT: (patch)
+; CHECK: BB: %join (patch)
+; CHECK-NOT: Function: keep
+; CHECK: Function: main
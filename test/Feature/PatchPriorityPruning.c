@@ -0,0 +1,47 @@
+// RUN: %clang %s -emit-llvm %O0opt -c -o %t.orig.bc
+// RUN: %clang %s -emit-llvm %O0opt -DPATCHED -c -o %t.patched.bc
+
+// Without pruning, all three paths are explored
+// RUN: rm -rf %t.klee-out
+// RUN: %klee --output-dir=%t.klee-out --search=patch-priority --compare-bitcode=%t.orig.bc %t.patched.bc 2>&1 | FileCheck --check-prefix=CHECK-ALL %s
+
+// With pruning, the side of the first branch which can't reach the patch is never forked
+// RUN: rm -rf %t.klee-out-pruned
+// RUN: %klee --output-dir=%t.klee-out-pruned --search=patch-priority --compare-bitcode=%t.orig.bc --pruning --write-paths --write-sym-paths %t.patched.bc 2>&1 | FileCheck --check-prefix=CHECK-PRUNED %s
+// RUN: test ! -f %t.klee-out-pruned/test000003.ktest
+
+// Both tests take the false side of the first branch, and then either side of the patched one
+// RUN: FileCheck --check-prefix=CHECK-PATH -input-file=%t.klee-out-pruned/test000001.path %s
+// RUN: FileCheck --check-prefix=CHECK-PATH -input-file=%t.klee-out-pruned/test000002.path %s
+// RUN: not diff %t.klee-out-pruned/test000001.path %t.klee-out-pruned/test000002.path
+
+// The branches are symbolic, so the symbolic paths record them the same way
+// RUN: diff %t.klee-out-pruned/test000001.path %t.klee-out-pruned/test000001.sym.path
+// RUN: diff %t.klee-out-pruned/test000002.path %t.klee-out-pruned/test000002.sym.path
+
+#include "klee/klee.h"
+
+int main() {
+  int x;
+  klee_make_symbolic(&x, sizeof(x), "x");
+
+  if (x > 10)
+    return 1;
+
+#ifdef PATCHED
+  if (x == 5)
+    return 3;
+#endif
+
+  return 0;
+}
+
+// CHECK-ALL: KLEE: done: completed paths = 3
+// CHECK-ALL: KLEE: done: generated tests = 3
+
+// CHECK-PRUNED: KLEE: done: completed paths = 2
+// CHECK-PRUNED: KLEE: done: generated tests = 2
+
+// CHECK-PATH: {{^}}0{{$}}
+// CHECK-PATH-NEXT: {{^[01]$}}
+// CHECK-PATH-NOT: {{.}}
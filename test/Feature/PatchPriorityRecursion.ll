@@ -0,0 +1,99 @@
+; Functions which call each other get their priorities as one strongly connected component: a patch in one of
+; them gives weight to the calls of all the others, and their returns are boosted by the return locations of the
+; calls made from within the component
+; RUN: sed -e 's/^;ORIG //' %s | %llvmas -o %t.orig.bc
+; RUN: sed -e 's/^;NEW //' %s | %llvmas -o %t.new.bc
+; RUN: rm -rf %t.klee-out
+; RUN: %klee --output-dir=%t.klee-out --search=patch-priority --compare-bitcode=%t.orig.bc --dump-patch-priorities %t.new.bc 2>&1 | FileCheck %s
+
+target datalayout = "e-p:64:64:64-i1:8:8-i8:8:8-i16:16:16-i32:32:32-i64:64:64-f32:32:32-f64:64:64-v64:64:64-v128:128:128-a0:0:64-s0:64:64-f80:128:128-n8:16:32:64"
+target triple = "x86_64-unknown-linux-gnu"
+
+@g = global i32 0, align 4
+
+define i32 @ping(i32 %n) {
+entry:
+  %z = icmp eq i32 %n, 0
+  br i1 %z, label %yes, label %no
+
+yes:
+  ret i32 1
+
+no:
+  %m = sub i32 %n, 1
+  %r = call i32 @pong(i32 %m)
+  ret i32 %r
+}
+
+define i32 @pong(i32 %n) {
+entry:
+  %z = icmp eq i32 %n, 0
+  br i1 %z, label %yes, label %no
+
+yes:
+  ret i32 2
+
+no:
+  %m = sub i32 %n, 1
+  %r = call i32 @pang(i32 %m)
+  ret i32 %r
+}
+
+define i32 @pang(i32 %n) {
+entry:
+  %z = icmp eq i32 %n, 0
+  br i1 %z, label %yes, label %no
+
+yes:
+  ret i32 3
+
+no:
+;NEW   store volatile i32 1, i32* @g, align 4
+  %m = sub i32 %n, 1
+  %r = call i32 @ping(i32 %m)
+  ret i32 %r
+}
+
+; unchanged and recursive on its own, only runs once the patch has
+define i32 @count(i32 %n) {
+entry:
+  %z = icmp eq i32 %n, 0
+  br i1 %z, label %yes, label %no
+
+yes:
+  ret i32 0
+
+no:
+  store volatile i32 2, i32* @g, align 4
+  %m = sub i32 %n, 1
+  %r = call i32 @count(i32 %m)
+  ret i32 %r
+}
+
+define i32 @main() {
+entry:
+  %r = call i32 @ping(i32 3)
+  %s = call i32 @count(i32 3)
+  ret i32 0
+}
+
+; ping and pong only reach the patch through the component, and return to the patch in pang
+; CHECK: Function: ping
+; CHECK-NEXT: BB: %entry
+; CHECK-NOT: Function:
+; CHECK: ret i32
+; CHECK-NOT: Function:
+; CHECK: call i32 @pong
+; CHECK: Function: pong
+; CHECK-NEXT: BB: %entry
+; CHECK-NOT: Function:
+; CHECK: ret i32
+; CHECK-NOT: Function:
+; CHECK: call i32 @pang
+; CHECK: Function: pang
+; CHECK-NOT: (patch)
+; CHECK: BB: %no (patch)
+; CHECK-NOT: Function: count
+; CHECK: Function: main
+; CHECK-NEXT: BB: %entry
+; CHECK-NEXT: call i32 @ping
@@ -0,0 +1,39 @@
+// RUN: %clang %s -emit-llvm %O0opt -c -o %t.orig.bc
+// RUN: %clang %s -emit-llvm %O0opt -DPATCHED -c -o %t.patched.bc
+
+// Under the patch-priority searcher, every test records whether its path ran patched code
+// RUN: rm -rf %t.klee-out
+// RUN: %klee --output-dir=%t.klee-out --search=patch-priority --compare-bitcode=%t.orig.bc %t.patched.bc 2>&1 | FileCheck %s
+// RUN: cat %t.klee-out/test000001.patch %t.klee-out/test000002.patch %t.klee-out/test000003.patch | sort | FileCheck --check-prefix=CHECK-RAN %s
+
+// Other searchers don't know what the patch is, so there are no records
+// RUN: rm -rf %t.klee-out-dfs
+// RUN: %klee --output-dir=%t.klee-out-dfs --search=dfs %t.patched.bc
+// RUN: test -f %t.klee-out-dfs/test000001.ktest
+// RUN: test ! -f %t.klee-out-dfs/test000001.patch
+
+#include "klee/klee.h"
+
+int main() {
+  int x;
+  klee_make_symbolic(&x, sizeof(x), "x");
+
+  // returns before the patch
+  if (x > 10)
+    return 1;
+
+#ifdef PATCHED
+  if (x == 5)
+    return 3;
+#endif
+
+  return 0;
+}
+
+// CHECK: KLEE: done: generated tests = 3
+
+// the path returning before the patch didn't run it, both sides of the patched branch did
+// CHECK-RAN: {{^0$}}
+// CHECK-RAN-NEXT: {{^1$}}
+// CHECK-RAN-NEXT: {{^1$}}
+// CHECK-RAN-NOT: {{.}}
@@ -0,0 +1,28 @@
+// REQUIRES: posix-runtime
+// REQUIRES: uclibc
+// RUN: %clang %s -emit-llvm %O0opt -c -o %t.bc
+// RUN: rm -rf %t.klee-out
+// RUN: %klee --output-dir=%t.klee-out --libc=uclibc --posix-runtime %t.bc
+
+// Serve a single request to replay the test, with its outputs going to the dump file named in it. The requests
+// are read from stdin, which can't take the reply, so the server stops after the first one
+// RUN: printf '%t.klee-out/test000001.ktest\t%t.dump\n' > %t.request
+// RUN: rm -rf %t.klee-out-server %t.dump
+// RUN: %klee --output-dir=%t.klee-out-server --libc=uclibc --posix-runtime --posix-compare --replay-server-fd=0 %t.bc < %t.request
+// RUN: FileCheck --input-file=%t.dump %s
+
+#include "klee/klee.h"
+
+#include <stdio.h>
+
+int main() {
+  int x;
+  klee_make_symbolic(&x, sizeof(x), "x");
+  klee_assume(x == 42);
+
+  printf("x is %d\n", x);
+  return 0;
+}
+
+// CHECK: x is 42
+// CHECK-NOT: {{.}}
@@ -0,0 +1,53 @@
+#include "Capture.h"
+
+#include <cassert>
+#include <unistd.h>
+#include <sys/mman.h>
+
+using std::string;
+
+Capture::Capture() {
+    // close-on-exec, spawn_command clears it for the replay which should inherit the capture
+    memfd = memfd_create("klee-compare-capture", MFD_CLOEXEC);
+    assert(memfd >= 0 && "Could not create capture for replay outputs");
+}
+
+Capture::~Capture() {
+    close(memfd);
+}
+
+string Capture::env() const {
+    return "KLEE_COMPARE_FD=" + std::to_string(memfd);
+}
+
+void Capture::clear() {
+    // the replay shares our file offset, so rewind it as well
+    if (ftruncate(memfd, 0) < 0 || lseek(memfd, 0, SEEK_SET) < 0) {
+        assert(false && "Could not clear capture");
+    }
+}
+
+string Capture::contents() const {
+    string outputs;
+    char buffer[64 * 1024];
+    off_t offset = 0;
+
+    ssize_t r;
+    while ((r = pread(memfd, buffer, sizeof(buffer), offset)) > 0) {
+        outputs.append(buffer, r);
+        offset += r;
+    }
+    return outputs;
+}
+
+void Capture::assign(const string &outputs) {
+    clear();
+    size_t written = 0;
+    while (written < outputs.size()) {
+        ssize_t w = write(memfd, outputs.data() + written, outputs.size() - written);
+        if (w <= 0) {
+            break;
+        }
+        written += w;
+    }
+}
@@ -0,0 +1,38 @@
+// Capture is the channel the POSIX-Compare runtime writes the outputs of a replay to
+
+#ifndef KLEE_COMPARE_CAPTURE_H
+#define KLEE_COMPARE_CAPTURE_H
+
+#include <string>
+
+// an anonymous in-memory file which a replay inherits, the runtime finds it through KLEE_COMPARE_FD
+// (see runtime/POSIX-compare/fd.c) and appends the outputs of the program to it
+// nothing ever touches the file system, so any number of replays can capture at the same time
+class Capture {
+public:
+    Capture();
+    ~Capture();
+
+    Capture(const Capture &) = delete;
+    Capture &operator=(const Capture &) = delete;
+
+    // the descriptor the replay has to inherit
+    int fd() const { return memfd; }
+
+    // environment assignment which points the runtime at this capture, to prefix the KLEE command with
+    std::string env() const;
+
+    // throw away the outputs of the last replay
+    void clear();
+
+    // everything captured since the last clear()
+    std::string contents() const;
+
+    // replace the captured outputs
+    void assign(const std::string &outputs);
+
+private:
+    int memfd;
+};
+
+#endif
@@ -0,0 +1,29 @@
+// hashing for comparing and caching outputs
+
+#ifndef KLEE_COMPARE_HASH_H
+#define KLEE_COMPARE_HASH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// fast non-cryptographic hash, mixes in a word at a time
+// passing the hash of the previous chunk as the seed continues it over several chunks
+inline uint64_t hash_bytes(const char *data, size_t size, uint64_t seed = 0xcbf29ce484222325ULL) {
+    const uint64_t mul = 0x9e3779b97f4a7c15ULL;
+    uint64_t h = seed ^ size;
+
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        h = (h ^ word) * mul;
+        h ^= h >> 32;
+    }
+    for (; i < size; i++) {
+        h = (h ^ (unsigned char) data[i]) * mul;
+    }
+    return h ^ (h >> 29);
+}
+
+#endif
@@ -0,0 +1,165 @@
+#include "OutputCompare.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#include <unistd.h>
+
+using std::string;
+
+// every record in a capture starts with the id of the call and the length of its data,
+// see runtime/POSIX-compare/fd.c
+static const size_t HEADER_SIZE = 5;
+
+// the ids used by the runtime, id 0 is for outputs which were captured some other way
+static const char *call_names[] = {
+    "output", "printf", "putchar", "fputs", "vfprintf", "fprintf", "fputc", "fwrite", "write",
+};
+
+// how much of the outputs is read and compared at a time
+static const size_t CHUNK_SIZE = 64 * 1024;
+
+static string call_name(uint8_t call) {
+    if (call < sizeof(call_names) / sizeof(call_names[0])) {
+        return call_names[call];
+    }
+    return "unknown call " + std::to_string(call);
+}
+
+namespace {
+
+// reads the data of the records in a capture as one stream, skipping over their headers
+class OutputReader {
+public:
+    explicit OutputReader(int fd) : fd(fd), buffer(CHUNK_SIZE) {}
+
+    // read up to size bytes of outputs, fewer only once the outputs end
+    size_t read(char *data, size_t size) {
+        size_t done = 0;
+        while (done < size) {
+            if (left == 0) {
+                char header[HEADER_SIZE];
+                if (!take_all(header, HEADER_SIZE)) {
+                    break;
+                }
+                current = header[0];
+                memcpy(&left, header + 1, sizeof(left));
+                continue;
+            }
+
+            size_t n = take(data + done, std::min<size_t>(size - done, left));
+            if (n == 0) {
+                break;
+            }
+            done += n;
+            left -= n;
+        }
+        return done;
+    }
+
+    // the call which wrote the last byte that was read
+    uint8_t call() const { return current; }
+
+private:
+    // up to size bytes of the capture itself, 0 at the end
+    size_t take(char *data, size_t size) {
+        if (pos == len) {
+            ssize_t r = pread(fd, buffer.data(), buffer.size(), offset);
+            if (r <= 0) {
+                return 0;
+            }
+            offset += r;
+            len = r;
+            pos = 0;
+        }
+
+        size_t n = std::min(size, len - pos);
+        memcpy(data, buffer.data() + pos, n);
+        pos += n;
+        return n;
+    }
+
+    bool take_all(char *data, size_t size) {
+        size_t done = 0;
+        while (done < size) {
+            size_t n = take(data + done, size - done);
+            if (n == 0) {
+                return false;
+            }
+            done += n;
+        }
+        return true;
+    }
+
+    int fd;
+    off_t offset = 0;
+    std::vector<char> buffer;
+    size_t pos = 0, len = 0;
+
+    // call id and bytes left of the record we're in
+    uint8_t current = 0;
+    uint32_t left = 0;
+};
+
+} // namespace
+
+// find the call which wrote the byte at offset of the outputs, or an empty string if the outputs are shorter
+static string call_at(const Capture &capture, uint64_t offset) {
+    OutputReader reader(capture.fd());
+    std::vector<char> skipped(CHUNK_SIZE);
+    while (offset > 0) {
+        size_t n = reader.read(skipped.data(), std::min<uint64_t>(offset, CHUNK_SIZE));
+        if (n == 0) {
+            return "";
+        }
+        offset -= n;
+    }
+
+    char byte;
+    if (reader.read(&byte, 1) == 0) {
+        return "";
+    }
+    return call_name(reader.call());
+}
+
+Divergence compare_outputs(const Capture &patched, const Capture &original) {
+    Divergence divergence;
+    OutputReader patched_reader(patched.fd()), original_reader(original.fd());
+    std::vector<char> patched_chunk(CHUNK_SIZE), original_chunk(CHUNK_SIZE);
+
+    uint64_t offset = 0;
+    while (true) {
+        size_t patched_size = patched_reader.read(patched_chunk.data(), CHUNK_SIZE);
+        size_t original_size = original_reader.read(original_chunk.data(), CHUNK_SIZE);
+
+        // find the first byte that differs, the end of the shorter chunk if they only differ in length
+        size_t common = std::min(patched_size, original_size);
+        size_t i = std::mismatch(patched_chunk.begin(), patched_chunk.begin() + common, original_chunk.begin()).first -
+                   patched_chunk.begin();
+
+        if (i == common && patched_size == original_size) {
+            // a short chunk means both outputs ended
+            if (patched_size < CHUNK_SIZE) {
+                return divergence;
+            }
+            offset += patched_size;
+            continue;
+        }
+
+        divergence.differ = true;
+        divergence.offset = offset + i;
+        divergence.call = call_at(patched, divergence.offset);
+        if (divergence.call.empty()) {
+            divergence.call = call_at(original, divergence.offset);
+        }
+        return divergence;
+    }
+}
+
+string output_record(const string &outputs) {
+    char header[HEADER_SIZE];
+    uint32_t length = outputs.size();
+    header[0] = 0;
+    memcpy(header + 1, &length, sizeof(length));
+    return string(header, HEADER_SIZE) + outputs;
+}
@@ -0,0 +1,30 @@
+// comparing the outputs two replays wrote to their captures
+
+#ifndef KLEE_COMPARE_OUTPUTCOMPARE_H
+#define KLEE_COMPARE_OUTPUTCOMPARE_H
+
+#include "Capture.h"
+
+#include <cstdint>
+#include <string>
+
+// where the outputs of the two versions first differ
+struct Divergence {
+    bool differ = false;
+
+    // offset of the first differing byte in the outputs of the program, not counting the record headers
+    uint64_t offset = 0;
+
+    // the call which wrote that byte, in the patched version unless its outputs ended before it
+    std::string call;
+};
+
+// compare the outputs captured for the patched and original versions
+// both captures are streamed and compared a chunk at a time
+Divergence compare_outputs(const Capture &patched, const Capture &original);
+
+// frame outputs which did not come from the POSIX-Compare runtime as a single record,
+// so they can be compared the same way
+std::string output_record(const std::string &outputs);
+
+#endif
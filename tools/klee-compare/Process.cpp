@@ -0,0 +1,56 @@
+#include "Process.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+using std::string;
+
+pid_t spawn_command(const string &command, const std::vector<int> &inherit_fds) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        for (int fd : inherit_fds) {
+            fcntl(fd, F_SETFD, 0);
+        }
+        execl("/bin/sh", "sh", "-c", command.c_str(), (char *) nullptr);
+        _exit(127);
+    }
+    return pid;
+}
+
+pid_t spawn_process(const std::vector<string> &argv, const std::vector<int> &inherit_fds) {
+    std::vector<char *> args;
+    for (const string &arg : argv) {
+        args.push_back(const_cast<char *>(arg.c_str()));
+    }
+    args.push_back(nullptr);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        for (int fd : inherit_fds) {
+            fcntl(fd, F_SETFD, 0);
+        }
+        execv(args[0], args.data());
+        _exit(127);
+    }
+    return pid;
+}
+
+int wait_command(pid_t pid) {
+    if (pid < 0) {
+        return -1;
+    }
+
+    int status;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            return -1;
+        }
+    }
+    return status;
+}
+
+int run_command(const string &command, const std::vector<int> &inherit_fds) {
+    return wait_command(spawn_command(command, inherit_fds));
+}
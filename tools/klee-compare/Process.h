@@ -0,0 +1,24 @@
+// helpers for running the shell commands klee-compare starts KLEE and friends with
+
+#ifndef KLEE_COMPARE_PROCESS_H
+#define KLEE_COMPARE_PROCESS_H
+
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+// run command with /bin/sh in a child process and return its pid (or -1)
+// klee-compare opens its descriptors close-on-exec so they don't leak into the other workers' children,
+// the ones in inherit_fds are kept open in this child under the same numbers
+pid_t spawn_command(const std::string &command, const std::vector<int> &inherit_fds = {});
+
+// same as spawn_command, but runs the program in argv[0] directly with the given arguments
+pid_t spawn_process(const std::vector<std::string> &argv, const std::vector<int> &inherit_fds = {});
+
+// wait for a child started by spawn_command, returns its wait status (or -1)
+int wait_command(pid_t pid);
+
+// spawn_command and wait for it to finish
+int run_command(const std::string &command, const std::vector<int> &inherit_fds = {});
+
+#endif
@@ -0,0 +1,191 @@
+#include "Protocol.h"
+
+#include <fstream>
+#include <sstream>
+#include <limits.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+using std::string;
+
+// limits on what we take off the wire, so a bad frame can't make us allocate without bound
+// the lines of the protocol hold at most a test name besides a few numbers
+static const size_t MAX_LINE = PATH_MAX;
+static const size_t MAX_KTEST = 256 << 20;
+static const size_t MAX_RESULT = 64 << 10;
+
+bool Channel::send_hello(const string &token) {
+    return send_all("hello " + token + "\n");
+}
+
+bool Channel::recv_hello(const string &token) {
+    string line, kind, sent;
+    if (!read_line(line)) {
+        return false;
+    }
+
+    std::istringstream in(line);
+    if (!(in >> kind >> sent) || kind != "hello" || sent.size() != token.size()) {
+        return false;
+    }
+    // don't tell how much of the token was right by how long it took to say no
+    unsigned char mismatch = 0;
+    for (size_t i = 0; i < token.size(); ++i) {
+        mismatch |= sent[i] ^ token[i];
+    }
+    return mismatch == 0;
+}
+
+bool Channel::send_job(unsigned step, const string &test, const string &ktest) {
+    return send_all("job " + std::to_string(step) + " " + test + " " + std::to_string(ktest.size()) + "\n" + ktest);
+}
+
+bool Channel::recv_job(unsigned &step, string &test, string &ktest) {
+    string line, kind;
+    size_t size;
+    if (!read_line(line)) {
+        return false;
+    }
+
+    std::istringstream in(line);
+    if (!(in >> kind >> step >> test >> size) || kind != "job" || size > MAX_KTEST) {
+        return false;
+    }
+    return read_bytes(size, ktest);
+}
+
+bool Channel::send_verdict(unsigned outcome, const string &result) {
+    return send_all("verdict " + std::to_string(outcome) + " " + std::to_string(result.size()) + "\n" + result);
+}
+
+bool Channel::recv_verdict(unsigned &outcome, string &result) {
+    string line, kind;
+    size_t size;
+    if (!read_line(line)) {
+        return false;
+    }
+
+    std::istringstream in(line);
+    if (!(in >> kind >> outcome >> size) || kind != "verdict" || outcome > 2 || size > MAX_RESULT) {
+        return false;
+    }
+    return read_bytes(size, result);
+}
+
+bool Channel::send_all(const string &data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        // don't die of SIGPIPE if the other end went away, we'll notice from the error
+        ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0) {
+            return false;
+        }
+        sent += n;
+    }
+    return true;
+}
+
+bool Channel::fill() {
+    char chunk[64 * 1024];
+    ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+    if (n <= 0) {
+        return false;
+    }
+    buffer.append(chunk, n);
+    return true;
+}
+
+bool Channel::read_line(string &line) {
+    size_t end;
+    while ((end = buffer.find('\n')) == string::npos) {
+        if (buffer.size() > MAX_LINE || !fill()) {
+            return false;
+        }
+    }
+    line = buffer.substr(0, end);
+    buffer.erase(0, end + 1);
+    return true;
+}
+
+bool Channel::read_bytes(size_t size, string &data) {
+    while (buffer.size() < size) {
+        if (!fill()) {
+            return false;
+        }
+    }
+    data = buffer.substr(0, size);
+    buffer.erase(0, size);
+    return true;
+}
+
+int listen_on(const string &host, unsigned port) {
+    // without AI_PASSIVE, no host means the loopback address
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    addrinfo *addrs;
+    if (getaddrinfo(host == "" ? nullptr : host.c_str(), std::to_string(port).c_str(), &hints, &addrs) != 0) {
+        return -1;
+    }
+
+    int sock = -1;
+    for (addrinfo *addr = addrs; addr && sock < 0; addr = addr->ai_next) {
+        sock = socket(addr->ai_family, addr->ai_socktype | SOCK_CLOEXEC, addr->ai_protocol);
+        if (sock < 0) {
+            continue;
+        }
+        int reuse = 1;
+        setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        if (bind(sock, addr->ai_addr, addr->ai_addrlen) < 0 || listen(sock, 16) < 0) {
+            close(sock);
+            sock = -1;
+        }
+    }
+    freeaddrinfo(addrs);
+    return sock;
+}
+
+int connect_to(const string &address) {
+    size_t colon = address.rfind(':');
+    if (colon == string::npos) {
+        return -1;
+    }
+
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    addrinfo *addrs;
+    if (getaddrinfo(address.substr(0, colon).c_str(), address.substr(colon + 1).c_str(), &hints, &addrs) != 0) {
+        return -1;
+    }
+
+    int sock = -1;
+    for (addrinfo *addr = addrs; addr && sock < 0; addr = addr->ai_next) {
+        sock = socket(addr->ai_family, addr->ai_socktype | SOCK_CLOEXEC, addr->ai_protocol);
+        if (sock >= 0 && connect(sock, addr->ai_addr, addr->ai_addrlen) < 0) {
+            close(sock);
+            sock = -1;
+        }
+    }
+    freeaddrinfo(addrs);
+    return sock;
+}
+
+string make_token() {
+    std::ifstream random("/dev/urandom", std::ios::binary);
+    unsigned char bytes[16];
+    if (!random.read(reinterpret_cast<char *>(bytes), sizeof(bytes))) {
+        return "";
+    }
+
+    static const char digits[] = "0123456789abcdef";
+    string token;
+    for (unsigned char byte : bytes) {
+        token += digits[byte >> 4];
+        token += digits[byte & 0xf];
+    }
+    return token;
+}
@@ -0,0 +1,52 @@
+// the protocol between klee-compare and the worker processes it hands tests to
+
+#ifndef KLEE_COMPARE_PROTOCOL_H
+#define KLEE_COMPARE_PROTOCOL_H
+
+#include <string>
+
+// one end of the connection between the coordinator and a worker, either a socketpair for local
+// workers or a TCP connection for workers on other machines
+// workers on other machines first prove they were invited with the coordinator's token:
+//   "hello <token>\n"
+// then the coordinator sends a job per test, along with the contents of the ktest since the worker may not see our files:
+//   "job <step> <test> <size>\n" followed by size bytes of ktest
+// and the worker answers each job with its verdict:
+//   "verdict <outcome> <size>\n" followed by size bytes of the line for the results file
+// where the outcome is 0 if the outputs match, 1 if they differ and 2 if a replay failed
+// lines, ktests and verdicts over the limits in Protocol.cpp are taken as a broken connection
+class Channel {
+public:
+    explicit Channel(int fd) : fd(fd) {}
+
+    bool send_hello(const std::string &token);
+    bool recv_hello(const std::string &token);
+
+    bool send_job(unsigned step, const std::string &test, const std::string &ktest);
+    bool recv_job(unsigned &step, std::string &test, std::string &ktest);
+
+    bool send_verdict(unsigned outcome, const std::string &result);
+    bool recv_verdict(unsigned &outcome, std::string &result);
+
+private:
+    bool send_all(const std::string &data);
+    bool fill();
+    bool read_line(std::string &line);
+    bool read_bytes(size_t size, std::string &data);
+
+    int fd;
+
+    // what we've received but not handed out yet
+    std::string buffer;
+};
+
+// listen for workers on host, or on loopback if host is empty, returns the socket or -1
+int listen_on(const std::string &host, unsigned port);
+
+// a random token for workers to authenticate with, or "" if there's no randomness to be had
+std::string make_token();
+
+// connect to a coordinator at "host:port", returns the socket or -1
+int connect_to(const std::string &address);
+
+#endif
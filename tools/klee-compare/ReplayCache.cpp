@@ -0,0 +1,87 @@
+#include "ReplayCache.h"
+#include "Hash.h"
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+using std::string;
+
+// hash a file along with its size, seed lets us mix in anything else the key depends on
+static string hash_file(const string &path, uint64_t seed) {
+    std::ifstream in(path, std::ios::binary);
+    std::vector<char> buffer(64 * 1024);
+    uint64_t h = seed;
+    uint64_t size = 0;
+
+    while (in) {
+        in.read(buffer.data(), buffer.size());
+        std::streamsize n = in.gcount();
+        if (n <= 0) {
+            break;
+        }
+        h = hash_bytes(buffer.data(), n, h);
+        size += n;
+    }
+
+    char key[64];
+    snprintf(key, sizeof(key), "%016llx-%llx", (unsigned long long) h, (unsigned long long) size);
+    return key;
+}
+
+ReplayCache::ReplayCache(string dir, string mode, const std::vector<string> &tools) : dir(dir), mode(mode) {
+    std::filesystem::create_directories(dir);
+
+    // a missing tool hashes like an empty file, which still changes the key once it shows up
+    for (const string &tool : tools) {
+        this->mode += " " + hash_file(tool, 0);
+    }
+}
+
+string ReplayCache::version_key(const string &bitcode) const {
+    return hash_file(bitcode, hash_bytes(mode.data(), mode.size()));
+}
+
+string ReplayCache::ktest_key(const string &ktest) const {
+    return hash_file(ktest, hash_bytes(nullptr, 0));
+}
+
+bool ReplayCache::load(const string &version, const string &ktest, Capture &capture) const {
+    std::ifstream in(dir + "/" + version + "/" + ktest, std::ios::binary);
+    if (!in) {
+        return false;
+    }
+
+    string outputs((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    capture.assign(outputs);
+    return true;
+}
+
+void ReplayCache::store(const string &version, const string &ktest, const Capture &capture) const {
+    string versiondir = dir + "/" + version;
+    std::filesystem::create_directories(versiondir);
+
+    // other workers (or runs) may store the same entry, so write it aside and move it in place in one go
+    std::ostringstream tmp;
+    tmp << versiondir << "/." << ktest << "." << getpid() << "." << std::this_thread::get_id();
+    {
+        std::ofstream out(tmp.str(), std::ios::binary);
+        string outputs = capture.contents();
+        out.write(outputs.data(), outputs.size());
+        if (!out) {
+            std::filesystem::remove(tmp.str());
+            return;
+        }
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(tmp.str(), versiondir + "/" + ktest, ec);
+    if (ec) {
+        std::filesystem::remove(tmp.str(), ec);
+    }
+}
@@ -0,0 +1,37 @@
+// ReplayCache keeps the outputs of replays across runs of klee-compare
+
+#ifndef KLEE_COMPARE_REPLAYCACHE_H
+#define KLEE_COMPARE_REPLAYCACHE_H
+
+#include "Capture.h"
+
+#include <string>
+#include <vector>
+
+// content addressed, the outputs of a replay are stored under the hash of the bitcode of the version
+// (and how it was replayed, and with which tools) and the hash of the ktest, so a version is only replayed again once it changes
+// every version gets its own directory in the cache, and every ktest a file in there
+class ReplayCache {
+public:
+    // mode tells apart replays of the same bitcode which capture different outputs (i.e. KLEE or native)
+    // tools are the files (KLEE, its runtime libraries, ...) the outputs also depend on, their contents go in the keys
+    ReplayCache(std::string dir, std::string mode, const std::vector<std::string> &tools);
+
+    // key for a version of the program, hashes the bitcode
+    std::string version_key(const std::string &bitcode) const;
+
+    // key for a ktest, hashes its contents
+    std::string ktest_key(const std::string &ktest) const;
+
+    // load the outputs of a replay into capture, returns false if they're not cached
+    bool load(const std::string &version, const std::string &ktest, Capture &capture) const;
+
+    // store the outputs of a replay
+    void store(const std::string &version, const std::string &ktest, const Capture &capture) const;
+
+private:
+    std::string dir;
+    std::string mode;
+};
+
+#endif
@@ -0,0 +1,98 @@
+#include "ReplayServer.h"
+#include "Process.h"
+
+#include <filesystem>
+#include <iostream>
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+using std::string;
+
+ReplayServer::ReplayServer(string klee_command, string outdir, string target, Capture &capture)
+    : klee_command(klee_command), outdir(outdir), target(target), capture(capture) {
+    start();
+}
+
+ReplayServer::~ReplayServer() {
+    stop();
+}
+
+bool ReplayServer::start() {
+    // KLEE refuses to reuse an output directory, clear the one from a server which died
+    std::filesystem::remove_all(outdir);
+
+    // close-on-exec keeps the sockets of the other servers from leaking into this instance of KLEE
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0) {
+        std::cout << "Error: cannot create socket for replay server" << std::endl;
+        return false;
+    }
+
+    string com = capture.env() + " " + klee_command + " --posix-compare --output-dir " + outdir;
+    com += " --replay-server-fd " + std::to_string(fds[1]) + " " + target;
+
+    // only our end of the socket and the capture should survive the exec
+    pid = spawn_command(com, {fds[1], capture.fd()});
+
+    close(fds[1]);
+    if (pid < 0) {
+        std::cout << "Error: cannot fork replay server" << std::endl;
+        close(fds[0]);
+        return false;
+    }
+
+    sock = fds[0];
+    return true;
+}
+
+void ReplayServer::stop() {
+    // closing the socket tells the server we're done
+    if (sock >= 0) {
+        close(sock);
+        sock = -1;
+    }
+    if (pid > 0) {
+        waitpid(pid, nullptr, 0);
+        pid = -1;
+    }
+}
+
+bool ReplayServer::replay(const string &ktest) {
+    capture.clear();
+    if (sock < 0 && !start()) {
+        return false;
+    }
+
+    // don't get killed by SIGPIPE if the server died
+    // no dump file in the request, the outputs go to the capture the server inherited
+    string request = ktest + "\n";
+    bool ok = send(sock, request.c_str(), request.size(), MSG_NOSIGNAL) == (ssize_t) request.size();
+
+    // wait for the reply to the request
+    string reply;
+    char c;
+    while (ok && reply.size() < 16) {
+        ssize_t r = read(sock, &c, 1);
+        if (r < 0 && errno == EINTR) {
+            continue;
+        }
+        if (r <= 0 || c == '\n') {
+            ok = r > 0;
+            break;
+        }
+        reply += c;
+    }
+
+    if (!ok) {
+        // the server died while replaying, start a new one for the next request
+        std::cout << "Replay server for " << target << " died, restarting" << std::endl;
+        stop();
+        start();
+        return false;
+    }
+
+    return reply == "ok";
+}
@@ -0,0 +1,41 @@
+// ReplayServer keeps one instance of KLEE alive for replaying ktests on a version of the program
+
+#ifndef KLEE_COMPARE_REPLAYSERVER_H
+#define KLEE_COMPARE_REPLAYSERVER_H
+
+#include "Capture.h"
+
+#include <string>
+#include <sys/types.h>
+
+// wraps an instance of "klee --replay-server-fd" which keeps the linked and prepared module
+// of one program version loaded, so every replay doesn't have to pay for setting it up again
+// requests go over a socketpair, one per line, and KLEE answers each once the replay is done
+class ReplayServer {
+public:
+    // klee_command is the command used to run KLEE, without the output dir and bitcode
+    // the outputs of every replay are captured in capture
+    ReplayServer(std::string klee_command, std::string outdir, std::string target, Capture &capture);
+    ~ReplayServer();
+
+    ReplayServer(const ReplayServer &) = delete;
+    ReplayServer &operator=(const ReplayServer &) = delete;
+
+    // replay the ktest, the outputs of the program end up in the capture
+    // returns false if the replay failed, in which case the server is restarted
+    bool replay(const std::string &ktest);
+
+private:
+    bool start();
+    void stop();
+
+    std::string klee_command;
+    std::string outdir;
+    std::string target;
+    Capture &capture;
+
+    pid_t pid = -1;
+    int sock = -1;
+};
+
+#endif
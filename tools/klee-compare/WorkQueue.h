@@ -0,0 +1,95 @@
+// WorkQueue is the queue of work handed from the thread watching KLEE to the comparison workers
+
+#ifndef KLEE_COMPARE_WORKQUEUE_H
+#define KLEE_COMPARE_WORKQUEUE_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+
+// bounded multi-producer multi-consumer queue, consumers sleep until there is work instead of polling
+// once the queue is closed, pop() hands out what is left and then returns false
+template <typename T>
+class WorkQueue {
+public:
+    explicit WorkQueue(std::size_t capacity) : capacity(capacity) {}
+
+    // add an item, waiting while the queue is full
+    // returns false if the queue was closed and the item was dropped
+    bool push(T item) {
+        std::unique_lock<std::mutex> guard(lock);
+        not_full.wait(guard, [this] { return closed || items.size() < capacity; });
+        if (closed) {
+            return false;
+        }
+        items.push_back(std::move(item));
+        not_empty.notify_one();
+        return true;
+    }
+
+    // take the oldest item, waiting while the queue is empty
+    // returns false once the queue is closed and there is nothing left
+    bool pop(T &item) {
+        std::unique_lock<std::mutex> guard(lock);
+        not_empty.wait(guard, [this] { return closed || !items.empty(); });
+        if (items.empty()) {
+            return false;
+        }
+        item = std::move(items.front());
+        items.pop_front();
+        not_full.notify_one();
+        return true;
+    }
+
+    // no more items will be pushed, wakes up everyone waiting on the queue
+    void close() {
+        std::lock_guard<std::mutex> guard(lock);
+        closed = true;
+        not_empty.notify_all();
+        not_full.notify_all();
+    }
+
+    // like close(), but drops the items which are still waiting as well
+    void cancel() {
+        std::lock_guard<std::mutex> guard(lock);
+        items.clear();
+        closed = true;
+        cancelled = true;
+        not_empty.notify_all();
+        not_full.notify_all();
+    }
+
+    // put back an item a consumer took but could not finish, for another consumer to take
+    // unlike push() this works after close() and doesn't wait for room, returns false if the queue was cancelled
+    bool retry(T item) {
+        std::lock_guard<std::mutex> guard(lock);
+        if (cancelled) {
+            return false;
+        }
+        items.push_front(std::move(item));
+        not_empty.notify_one();
+        return true;
+    }
+
+    bool empty() {
+        std::lock_guard<std::mutex> guard(lock);
+        return items.empty();
+    }
+
+    std::size_t size() {
+        std::lock_guard<std::mutex> guard(lock);
+        return items.size();
+    }
+
+private:
+    std::mutex lock;
+    std::condition_variable not_empty;
+    std::condition_variable not_full;
+    std::deque<T> items;
+    std::size_t capacity;
+    bool closed = false;
+    bool cancelled = false;
+};
+
+#endif
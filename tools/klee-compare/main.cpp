@@ -1,5 +1,13 @@
 // klee-compare is a wrapper for patch comparison which invokes instances of KLEE
 
+#include "Capture.h"
+#include "OutputCompare.h"
+#include "Process.h"
+#include "Protocol.h"
+#include "ReplayCache.h"
+#include "ReplayServer.h"
+#include "WorkQueue.h"
+
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Support/FileSystem.h"
@@ -8,18 +16,30 @@
 #include <string>
 #include <iostream>
 #include <thread>
+#include <mutex>
+#include <atomic>
 #include <chrono>
-#include <queue>
+#include <condition_variable>
+#include <functional>
+#include <vector>
+#include <unordered_set>
+#include <algorithm>
+#include <memory>
 #include <filesystem>
 #include <fstream>
+#include <sstream>
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
 #include <unistd.h>
 #include <signal.h>
+#include <poll.h>
+#include <sys/eventfd.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
 
 using namespace llvm;
 using std::string;
@@ -43,6 +63,81 @@ namespace {
     cl::opt<bool>
     Pruning("pruning", cl::desc("Enable path pruning in Patch-Directed Searcher (default=false)"));
 
+    cl::opt<bool>
+    Distance("distance", cl::desc("With --directed, prioritize the states closest to the patched code (default=false)"));
+
+    cl::opt<bool>
+    SkipUnpatched("skip-unpatched", cl::desc("With --directed, skip the tests which never ran patched code. Only changes "
+                                             "to code are seen, so a test may still differ by reading a changed "
+                                             "global (default=false)"));
+
+    cl::opt<string>
+    CacheDir("cache-dir", cl::desc("Cache the outputs of replays in this directory across runs, so that only versions "
+                                   "whose bitcode changed are replayed again (default=off)"),
+             cl::init(""));
+
+    cl::opt<unsigned>
+    MaxDifferences("max-differences", cl::desc("Stop once this many paths with differing outputs were found "
+                                               "(default=0, no limit)"),
+                   cl::init(0));
+
+    cl::opt<unsigned>
+    MaxComparedPaths("max-compared-paths", cl::desc("Stop once this many paths were compared (default=0, no limit)"),
+                     cl::init(0));
+
+    cl::opt<unsigned>
+    MaxTime("max-time", cl::desc("Stop after this many seconds, including exploration and replays "
+                                 "(default=0, no limit)"),
+            cl::init(0));
+
+    cl::opt<unsigned>
+    Jobs("jobs", cl::desc("Number of ktests to replay in parallel (default=1)"), cl::init(1));
+
+    cl::opt<bool>
+    UseReplayServer("replay-server", cl::desc("Keep an instance of KLEE per program version resident in every worker "
+                                              "for replaying, instead of starting KLEE for every test (default=false)"));
+
+    cl::opt<bool>
+    NativeReplay("native-replay", cl::desc("Replay the tests on native builds of both versions using klee-replay, "
+                                           "instead of replaying them in KLEE (default=false)"));
+
+    cl::opt<string>
+    NativeCC("native-cc", cl::desc("Compiler used to build the native versions for --native-replay (default=clang)"),
+             cl::init("clang"));
+
+    cl::list<string>
+    Series("series", cl::CommaSeparated,
+           cl::desc("Compare a patch series: the bitcode of the versions between <original> and <patched>, "
+                    "oldest first. Every version is compared against the one before it"));
+
+    cl::opt<unsigned>
+    LocalWorkers("local-workers", cl::desc("Number of worker processes to start for replaying, next to the --jobs "
+                                           "worker threads (default=0)"),
+                 cl::init(0));
+
+    cl::opt<unsigned>
+    Listen("listen", cl::desc("Accept worker processes started with --connect on other machines on this port "
+                              "(default=0, off)"),
+           cl::init(0));
+
+    cl::opt<string>
+    ListenAddress("listen-address", cl::desc("Address to accept workers on with --listen (default=loopback only)"),
+                  cl::init(""));
+
+    cl::opt<string>
+    Token("token", cl::desc("Token workers authenticate with. The coordinator picks a random one and prints it "
+                            "unless one is given, workers started with --connect need it"),
+          cl::init(""));
+
+    cl::opt<string>
+    Connect("connect", cl::desc("Run as a worker process for the klee-compare at <host>:<port>, replaying the tests "
+                                "it sends. Takes the same versions (and replay options) as the coordinator"),
+            cl::init(""));
+
+    cl::opt<int>
+    WorkerFd("worker-fd", cl::desc("Run as a local worker process talking to the coordinator on this descriptor"),
+             cl::init(-1), cl::Hidden);
+
     cl::list<string>
     InputArgv(cl::ConsumeAfter,
               cl::desc("<program arguments>..."));
@@ -82,146 +177,846 @@ string create_output_dir() {
     return outdir;
 }
 
-// go through the streams and return true if the contents of the files are different
-bool files_differ(std::ifstream &file_a, std::ifstream &file_b) {
-    string line_a, line_b;
-    while(std::getline(file_a, line_a)) {
-        if(!std::getline(file_b, line_b)) {
-            return true;
-        }
-        if (line_a != line_b) {
-            return true;
-        }
-    }
-    // we've finished reading file_a, check if there's anything else to read in file_b
-    if(std::getline(file_b, line_b)) {
-        return true;
-    }
-    return false;
-}
-
-// helper function to run an instance of KLEE using a ktest
+// helper function to run an instance of KLEE using a ktest, the outputs are captured in capture
+// returns false if KLEE failed
 // TODO: print diff of the program outputs in the results file or so
-void run_klee_instance(string klee_command, string outdir, string ktest, string target) {
-    // set this for the POSIX-Compare Runtime
-    // there is no std version of setenv? using stdlib.h version
-    // TODO: this breaks things, not sure why. we'll just used a hardcoded /tmp path
-    // setenv("KLEE_OUTPUT_PATH", outdir.c_str(), 1);
+bool run_klee_instance(string klee_command, string outdir, Capture &capture, string ktest, string target) {
+    // the POSIX-Compare runtime appends to the capture, so clear anything left from the last run
+    capture.clear();
 
-    string com = klee_command + " --posix-compare --output-dir " + outdir;
+    // the runtime finds the capture through the environment of the replayed program,
+    // setting it only for this command keeps the workers from racing on setenv
+    string com = capture.env() + " " + klee_command;
+    com += " --posix-compare --output-dir " + outdir;
     com += " --replay-ktest-file " + ktest + " " + target;
     // TODO: make this a command line argument
     // com += " &> /dev/null"; // don't wanna print this output
     
     if (DEBUG_PRINTS) std::cout << "Running command " << com << std::endl;
 
-    FILE *fd = popen(com.c_str(), "w");
-
     // wait for the instance of KLEE to terminate
-    pclose(fd);
+    return run_command(com, {capture.fd()}) == 0;
+}
 
-    // move the output file so we can inspect it before the next run
-    // the /tmp filepath is hardcoded in POSIX-Compare/fd.c
-    // TODO: extra file moving is not really necessary, we might as well load this into a buffer now
-    if(std::filesystem::exists("/tmp/klee_compare_dump.txt")) {
-        std::filesystem::rename("/tmp/klee_compare_dump.txt", outdir + "/compare_dump.txt");
-    } else {
-        // if no such file existed, we'll just create an empty file in the output dir
-        std::ofstream(outdir + "/compare_dump.txt");
+// same as run_klee_instance, but replays on an instance of KLEE which is already running
+bool replay_on_server(ReplayServer &server, string ktest) {
+    if (DEBUG_PRINTS) std::cout << "Replaying " << ktest << " on server" << std::endl;
+    return server.replay(ktest);
+}
+
+// build a native executable of a version of the program for --native-replay
+// the klee_* intrinsics are provided by the kleeRuntest library which klee-replay uses to feed in the ktest
+bool build_native(string klee_path, string bitcode, string exe) {
+    string libdir = klee_path + "/../lib";
+    string com = NativeCC + " " + bitcode + " -o " + exe;
+    com += " -L" + libdir + " -Wl,-rpath," + libdir + " -lkleeRuntest";
+
+    if (DEBUG_PRINTS) std::cout << "Running command " << com << std::endl;
+    return system(com.c_str()) == 0;
+}
+
+// helper function to replay a ktest on a native build of the program using klee-replay
+// the outputs we compare are everything the program writes to stdout and stderr, followed by its exit status
+// returns false if the program could not be run
+bool run_native_instance(string replay_command, string exe, Capture &capture, string ktest) {
+    capture.clear();
+    string fd = std::to_string(capture.fd());
+    string com = replay_command + " " + exe + " " + ktest + " >&" + fd + " 2>&1";
+
+    if (DEBUG_PRINTS) std::cout << "Running command " << com << std::endl;
+
+    int status = run_command(com, {capture.fd()});
+    if (status < 0) {
+        return false;
     }
+
+    // drop the notes klee-replay prints itself, they include timings which would never match
+    std::istringstream in(capture.contents());
+    string outputs, line;
+    while (std::getline(in, line)) {
+        if (line.rfind("KLEE-REPLAY: ", 0) != 0) {
+            outputs += line + "\n";
+        }
+    }
+
+    // klee-replay exits with the status of the program
+    outputs += "exit status: " + std::to_string(WIFEXITED(status) ? WEXITSTATUS(status) : -1) + "\n";
+    capture.assign(output_record(outputs));
+    return true;
 }
 
-void watch_klee_output(string watchdir, std::queue<string> *ktests) {
-    // watch the output directory for KLEE
-    int notif, wdir;
-    char buffer[EVENT_BUF_LEN];
+// a version of the program and what we need to replay tests on it
+struct Version {
+    string bitcode;
+
+    // native build, for --native-replay
+    string native;
+
+    // key of the version in the replay cache, for --cache-dir
+    string cache_key;
+};
+
+// one comparison of a version against the one before it
+// without --series there is just the one step, comparing <patched> against <original>
+struct Step {
+    // indices into the versions
+    unsigned patched;
+    unsigned original;
+
+    // KLEE writes the tests for this step in here, and the results go here too
+    string outdir;
+
+    // results file and summary counters of this step
+    std::ofstream resout;
+    int paths = 0;
+    int differences = 0;
+    int skipped = 0;
+    int failed = 0;
+};
+
+// a test waiting to be compared, and the step it belongs to
+struct Job {
+    unsigned step;
+    string test;
+};
+
+// state shared by the comparison workers
+struct CompareContext {
+    string klee_command;
+    string outdir;
+
+    // klee-replay command, for --native-replay
+    string replay_command;
+
+    // the versions in the order they're compared, and the steps comparing them
+    std::vector<Version> versions;
+    std::vector<std::unique_ptr<Step>> steps;
 
-    notif = inotify_init();
-    wdir = inotify_add_watch(notif, watchdir.c_str(), IN_CREATE);
+    // outputs of earlier replays, for --cache-dir
+    std::unique_ptr<ReplayCache> cache;
+
+    // ktests waiting to be compared, filled by watch_klee_output
+    // bounded so a burst of tests from KLEE doesn't pile up in memory
+    WorkQueue<Job> ktests{1024};
+
+    // guards the results of all steps, and the totals the budgets are checked against
+    std::mutex results_lock;
+    int paths = 0;
+    int differences = 0;
+
+    // when comparing started and when the first difference was found (if one was), for the summary
+    std::chrono::steady_clock::time_point start;
+    std::chrono::steady_clock::time_point first_difference;
+
+    // the main thread waits on progress for KLEE and the workers to finish, or for a budget to run out
+    // once one does, out_of_budget is set along with the reason for the summary
+    std::mutex progress_lock;
+    std::condition_variable progress;
+    bool exploring = false;
+    unsigned workers_running = 0;
+    std::atomic<bool> out_of_budget{false};
+    string stop_reason;
+    std::chrono::steady_clock::time_point deadline;
+
+    // the sockets of the worker processes being fed, so we can cut them off once we're done
+    // a connection leaves the set before its socket is closed, so we never touch a reused descriptor
+    std::mutex connections_lock;
+    std::unordered_set<int> connections;
+
+    // worker threads started because there was no other worker to take the tests, see replay_locally
+    std::vector<std::thread> fallback_workers;
+};
+
+// stop comparing early, the first reason given ends up in the summary
+void stop_early(CompareContext *ctx, const string &reason) {
+    std::lock_guard<std::mutex> guard(ctx->progress_lock);
+    if (!ctx->out_of_budget) {
+        ctx->stop_reason = reason;
+        ctx->out_of_budget = true;
+    }
+    ctx->progress.notify_all();
+}
+
+// wait until done() holds, with progress_lock held, or until a budget runs out
+// returns false in the latter case
+bool wait_for(CompareContext *ctx, std::function<bool()> done) {
+    std::unique_lock<std::mutex> guard(ctx->progress_lock);
+    auto ready = [ctx, &done] { return ctx->out_of_budget || done(); };
+
+    if (MaxTime == 0) {
+        ctx->progress.wait(guard, ready);
+    } else if (!ctx->progress.wait_until(guard, ctx->deadline, ready)) {
+        ctx->stop_reason = "used up --max-time of " + std::to_string(MaxTime) + " seconds";
+        ctx->out_of_budget = true;
+    }
+    return !ctx->out_of_budget;
+}
+
+// KLEE records next to the ktest whether the test ran patched code, when the patch-directed searcher is used
+// the test can't produce different outputs if it didn't, so there's no point in replaying it
+bool ran_patched_code(const string &ktest) {
+    string sidecar = ktest.substr(0, ktest.length() - 6) + ".patch";
+    std::ifstream in(sidecar);
+    int ran;
+    if (!(in >> ran)) {
+        // no record, so we can't tell
+        return true;
+    }
+    return ran != 0;
+}
+
+// test files are all named like "test000006.ktest"
+// we can just check for the ktest where we expect it + string length
+bool is_ktest(const string &filename) {
+    return filename.length() == 16 && filename.substr(10, 6) == ".ktest";
+}
+
+// queue a ktest of the step for comparison unless we've already seen it
+void queue_ktest(const string &filename, unsigned step, CompareContext *ctx, std::unordered_set<string> &seen) {
+    if (is_ktest(filename) && seen.insert(filename).second) {
+        // we have a test file to compare!
+        if (DEBUG_PRINTS) printf("New test file %s found.\n", filename.c_str());
+        ctx->ktests.push({step, filename});
+    }
+}
+
+// queue every ktest in the directory, for when we may have missed some events
+void scan_klee_output(string watchdir, unsigned step, CompareContext *ctx, std::unordered_set<string> &seen) {
+    std::vector<string> filenames;
+    for (const auto &entry : std::filesystem::directory_iterator(watchdir)) {
+        filenames.push_back(entry.path().filename().string());
+    }
+    // keep the order KLEE wrote them in
+    std::sort(filenames.begin(), filenames.end());
+    for (const string &filename : filenames) {
+        queue_ktest(filename, step, ctx, seen);
+    }
+}
+
+// read and process the inotify events which are available without blocking
+void read_inotify_events(int notif, string watchdir, unsigned step, CompareContext *ctx,
+                         std::unordered_set<string> &seen) {
+    char buffer[EVENT_BUF_LEN] __attribute__((aligned(__alignof__(struct inotify_event))));
 
-    // the read call will block until a file is written by KLEE
-    // so we can loop forever on this thread and kill it when KLEE is done
     while (true) {
-        int length = read(notif, buffer, EVENT_BUF_LEN);
-        assert(length != 0 && "Error reading from inotify");
-
-        // Read and process the inotify event
-        int i = 0;
-        while (i < length) {     
-            inotify_event *event = (inotify_event *) &buffer[i];     
-            if (event->len) {
-                if (event->mask & IN_CREATE && !(event->mask & IN_ISDIR)) {
-                    string filename(event->name);
-                    // test files are all named like "test000006.ktest"
-                    // we can just check for the ktest where we expect it + string length
-                    if (filename.length() == 16 && filename.substr(10, 6) == ".ktest") {
-                        // we have a test file to compare!
-                        if (DEBUG_PRINTS) printf("New test file %s found.\n", event->name);
-                        ktests->push(filename);
-                    }
-                }
-            }   
+        ssize_t length = read(notif, buffer, EVENT_BUF_LEN);
+        if (length <= 0) {
+            // EAGAIN, we've read everything there is
+            return;
+        }
+
+        ssize_t i = 0;
+        while (i < length) {
+            inotify_event *event = (inotify_event *) &buffer[i];
+            if (event->mask & IN_Q_OVERFLOW) {
+                // the kernel dropped events, look for the ktests ourselves
+                scan_klee_output(watchdir, step, ctx, seen);
+            } else if (event->len && !(event->mask & IN_ISDIR)) {
+                queue_ktest(event->name, step, ctx, seen);
+            }
             i += EVENT_SIZE + event->len;
         }
     }
+}
 
-    inotify_rm_watch(notif, wdir);
-    close(notif);
+// watch the output directory of KLEE and queue the tests it writes for the step, until stopfd is signalled
+// notif must already be watching watchdir so nothing written before this thread started is missed
+void watch_klee_output(string watchdir, unsigned step, int notif, int stopfd, CompareContext *ctx) {
+    std::unordered_set<string> seen;
+    pollfd fds[2] = {{notif, POLLIN, 0}, {stopfd, POLLIN, 0}};
+
+    // sleep until there are events or we're told to stop
+    while (true) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        if (fds[0].revents & POLLIN) {
+            read_inotify_events(notif, watchdir, step, ctx, seen);
+        }
+        if (fds[1].revents & POLLIN) {
+            break;
+        }
+    }
+
+    // KLEE is done, queue what's left of the events and anything we may have missed
+    read_inotify_events(notif, watchdir, step, ctx, seen);
+    scan_klee_output(watchdir, step, ctx, seen);
 }
 
-// this function is run in a separate thread than the main thread which looks for ktest files
-// this does the actual comparison between the two versions of the programs
-// it stops when "done" is set to true by the caller thread (or something)
-// this thread also handles writing the results
-void compare(bool *done, string klee_command, string outdir, std::queue<string> *ktests) {
-    int paths = 0;
-    int differences = 0;
-    std::ofstream resout(outdir + "/results.txt");
+// replay the ktest on one version of the program however we were asked to, the outputs end up in capture
+// returns false if the replay failed
+bool replay_version(CompareContext *ctx, ReplayServer *server, string outdir, const Version &version,
+                    Capture &capture, string ktest) {
+    if (NativeReplay) {
+        return run_native_instance(ctx->replay_command, version.native, capture, ktest);
+    }
+    if (server) {
+        return replay_on_server(*server, ktest);
+    }
+    return run_klee_instance(ctx->klee_command, outdir, capture, ktest, version.bitcode);
+}
 
-    while(!(*done)) {
-        while (!ktests->empty()) {
-            // create the command which we'll use to replay the test with KLEE 
-            string test = ktests->front();
-            ktests->pop();
+// the outcome of comparing a test, sent as is by worker processes
+struct Verdict {
+    // Failed if a replay failed even when retried, so there were no outputs to compare
+    enum Outcome { Match = 0, Differ = 1, Failed = 2 };
+    unsigned outcome;
 
-            // set output dir as patched or program out
-            string patched_outdir = outdir + "/klee-patched-out";
-            string original_outdir = outdir + "/klee-original-out";
+    // the line for the results file
+    string result;
+};
 
-            // run both instances of KLEE for comparison
-            run_klee_instance(klee_command, patched_outdir, outdir + "/klee-out/" + test, TargetFile);
-            run_klee_instance(klee_command, original_outdir, outdir + "/klee-out/" + test, CompareFile);
+// replays tests on the versions of the program and compares their outputs, every worker thread
+// (or process) has its own, set up in its own directory so that the replays don't collide
+// in a series, a version takes part in the steps before and after it, so both share what's set up for it
+class Replayer {
+public:
+    Replayer(CompareContext *ctx, string workdir) : ctx(ctx), workdir(workdir) {
+        std::filesystem::create_directory(workdir);
+
+        // the outputs of the replays of every version
+        for (unsigned i = 0; i < ctx->versions.size(); ++i) {
+            captures.emplace_back(new Capture());
+        }
+        servers.resize(ctx->versions.size());
+    }
 
-            // get the results from outdir/write_dump.txt and compare them
-            std::ifstream patched_dump(patched_outdir + "/compare_dump.txt");
-            std::ifstream original_dump(original_outdir + "/compare_dump.txt");
+    ~Replayer() {
+        // shut the servers down before we clean up after them
+        servers.clear();
+        std::filesystem::remove_all(workdir);
+    }
 
-            bool differs = files_differ(patched_dump, original_dump);
+    // replay the ktest on both versions of the step and compare their outputs
+    Verdict compare(const Step &step, const string &test, const string &ktest) {
+        const Version &patched = ctx->versions[step.patched];
+        const Version &original = ctx->versions[step.original];
+        Capture &patched_capture = *captures[step.patched];
+        Capture &original_capture = *captures[step.original];
 
-            patched_dump.close();
-            original_dump.close();
+        // a version whose outputs for this ktest are cached doesn't need to be replayed again
+        string ktest_key;
+        bool patched_cached = false, original_cached = false;
+        if (ctx->cache) {
+            ktest_key = ctx->cache->ktest_key(ktest);
+            patched_cached = ctx->cache->load(patched.cache_key, ktest_key, patched_capture);
+            original_cached = ctx->cache->load(original.cache_key, ktest_key, original_capture);
+        }
 
-            string res = "Outputs" + string(differs ? " DIFFER " : " MATCH " ) + "on test: " + test;
+        // run both instances of KLEE for comparison
+        bool replayed = true;
+        if (!patched_cached) {
+            replayed = replay(step.patched, ktest, ktest_key);
+        }
+        if (replayed && !original_cached) {
+            replayed = replay(step.original, ktest, ktest_key);
+        }
 
-            if (DEBUG_PRINTS) std::cout << res << std::endl;
-            resout << res << std::endl;
+        // delete output dirs before next run, the servers keep theirs until they exit
+        if (!use_server) {
+            std::filesystem::remove_all(replay_outdir(step.patched));
+            std::filesystem::remove_all(replay_outdir(step.original));
+        }
 
-            if (differs) differences += 1;
+        if (!replayed) {
+            return {Verdict::Failed, "Replay FAILED on test: " + test};
+        }
 
-            // delete output dirs before next run
-            std::filesystem::remove_all(patched_outdir);
-            std::filesystem::remove_all(original_outdir);
+        // compare what both replays captured
+        Divergence divergence = compare_outputs(patched_capture, original_capture);
+        bool differs = divergence.differ;
 
-            paths += 1;
+        string res = "Outputs" + string(differs ? " DIFFER " : " MATCH " ) + "on test: " + test;
+        if (differs) {
+            res += " (first difference at byte " + std::to_string(divergence.offset) + ", written by " + divergence.call + ")";
         }
-        // ktests must be empty, let KLEE run for a bit more before we try again
-        std::this_thread::sleep_for(std::chrono::milliseconds(500));
+        return {differs ? Verdict::Differ : Verdict::Match, res};
     }
 
-    // print summary of comparison results
-    resout << "\nPaths compared: " << paths << std::endl;
-    resout << "Paths differing: " << differences << std::endl;
-    resout.close();
+private:
+    // replay the ktest on the version, and cache its outputs if we keep them
+    // a failed replay is tried once more, since a replay server which died is restarted for the next one
+    bool replay(unsigned version, const string &ktest, const string &ktest_key) {
+        const Version &v = ctx->versions[version];
+        for (int attempt = 0; attempt < 2; ++attempt) {
+            if (replay_version(ctx, server_for(version), replay_outdir(version), v, *captures[version], ktest)) {
+                if (ctx->cache) {
+                    ctx->cache->store(v.cache_key, ktest_key, *captures[version]);
+                }
+                return true;
+            }
+            std::cout << "Replaying " << ktest << " on " << v.bitcode << " failed"
+                      << (attempt == 0 ? ", retrying" : "") << std::endl;
+
+            // KLEE won't write into the output dir the failed replay left behind
+            if (!use_server) {
+                std::filesystem::remove_all(replay_outdir(version));
+            }
+        }
+        return false;
+    }
+
+    string replay_outdir(unsigned version) {
+        return workdir + "/klee-version-" + std::to_string(version) + "-out";
+    }
+
+    // resident instance of KLEE for the version if we're not starting KLEE for every test
+    // native replays don't go through KLEE at all
+    ReplayServer *server_for(unsigned version) {
+        if (!use_server) {
+            return nullptr;
+        }
+        if (!servers[version]) {
+            servers[version].reset(new ReplayServer(ctx->klee_command, replay_outdir(version),
+                                                    ctx->versions[version].bitcode, *captures[version]));
+        }
+        return servers[version].get();
+    }
+
+    CompareContext *ctx;
+    string workdir;
+    bool use_server = UseReplayServer && !NativeReplay;
+    std::vector<std::unique_ptr<Capture>> captures;
+    std::vector<std::unique_ptr<ReplayServer>> servers;
+};
+
+// skip the test if it can't tell the versions apart, returns true if it was skipped
+bool skip_test(CompareContext *ctx, Step &step, const string &test, const string &ktest) {
+    if (!SkipUnpatched || ran_patched_code(ktest)) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> guard(ctx->results_lock);
+    string res = "Skipped test: " + test + " (did not run patched code)";
+    if (DEBUG_PRINTS) std::cout << res << std::endl;
+    step.resout << res << std::endl;
+    step.skipped += 1;
+    return true;
+}
+
+// add the verdict on a test to the results, and check the budgets
+// tests which failed to replay were not compared, so they don't count towards them
+// returns false if a budget already ran out, in which case the verdict is dropped
+bool record_verdict(CompareContext *ctx, Step &step, const Verdict &verdict) {
+    std::lock_guard<std::mutex> guard(ctx->results_lock);
+    // another worker may have used up a budget while we were replaying
+    if (ctx->out_of_budget) {
+        return false;
+    }
+
+    if (DEBUG_PRINTS) std::cout << verdict.result << std::endl;
+    step.resout << verdict.result << std::endl;
+
+    if (verdict.outcome == Verdict::Failed) {
+        step.failed += 1;
+        return true;
+    }
+
+    if (verdict.outcome == Verdict::Differ) {
+        if (ctx->differences == 0) {
+            ctx->first_difference = std::chrono::steady_clock::now();
+        }
+        step.differences += 1;
+        ctx->differences += 1;
+    }
+    step.paths += 1;
+    ctx->paths += 1;
+
+    if (MaxDifferences > 0 && ctx->differences >= (int) MaxDifferences) {
+        stop_early(ctx, "found " + std::to_string(ctx->differences) + " differing paths (--max-differences)");
+    } else if (MaxComparedPaths > 0 && ctx->paths >= (int) MaxComparedPaths) {
+        stop_early(ctx, "compared " + std::to_string(ctx->paths) + " paths (--max-compared-paths)");
+    }
+    return true;
+}
+
+// a worker thread or a connection to a worker process is done
+void worker_finished(CompareContext *ctx) {
+    std::lock_guard<std::mutex> guard(ctx->progress_lock);
+    ctx->workers_running -= 1;
+    ctx->progress.notify_all();
+}
+
+void compare(CompareContext *ctx, unsigned worker);
+
+// with --listen and no --jobs, the tests may have nobody to take them, in which case the queue fills up and
+// the thread watching KLEE waits for room forever. start a worker thread to replay them here if that's so
+// must be called with progress_lock held
+void replay_locally(CompareContext *ctx) {
+    if (ctx->workers_running > 0 || ctx->out_of_budget) {
+        return;
+    }
+
+    // only started when no other worker thread is running, so it can have the first worker directory
+    std::cout << "No workers to replay the tests, replaying them here" << std::endl;
+    ctx->workers_running += 1;
+    ctx->fallback_workers.emplace_back(compare, ctx, 0);
+}
+
+// a connection to a worker process broke, after its test was put back in the queue
+// if that was the last worker, nobody is left to take the queued tests. if more workers can't connect,
+// stop like a budget ran out rather than wait for them forever, otherwise replay them here in the meantime
+void worker_lost(CompareContext *ctx) {
+    std::lock_guard<std::mutex> guard(ctx->progress_lock);
+    ctx->workers_running -= 1;
+    if (ctx->workers_running == 0 && Listen == 0 && !ctx->out_of_budget) {
+        ctx->stop_reason = "every worker exited, leaving " + std::to_string(ctx->ktests.size()) +
+                           " queued tests uncompared";
+        ctx->out_of_budget = true;
+    }
+    replay_locally(ctx);
+    ctx->progress.notify_all();
+}
+
+// this function is run by each of the --jobs worker threads, separate from the main thread
+// which looks for ktest files. this does the actual comparison between the two versions of
+// the programs, every worker replays in its own directory so that the replays don't collide
+// it stops once the queue of ktests is closed and empty
+void compare(CompareContext *ctx, unsigned worker) {
+    {
+        Replayer replayer(ctx, ctx->outdir + "/worker-" + std::to_string(worker));
+
+        Job job;
+        while (ctx->ktests.pop(job)) {
+            if (ctx->out_of_budget) {
+                break;
+            }
+
+            Step &step = *ctx->steps[job.step];
+            string ktest = step.outdir + "/klee-out/" + job.test;
+            if (skip_test(ctx, step, job.test, ktest)) {
+                continue;
+            }
+            if (!record_verdict(ctx, step, replayer.compare(step, job.test, ktest))) {
+                break;
+            }
+        }
+    }
+    worker_finished(ctx);
+}
+
+// how long a worker connecting over the network has to send the token
+const int HELLO_TIMEOUT_SECONDS = 10;
+
+// stop tracking the connection and close it
+void close_connection(CompareContext *ctx, int fd) {
+    {
+        std::lock_guard<std::mutex> guard(ctx->connections_lock);
+        ctx->connections.erase(fd);
+    }
+    close(fd);
+}
+
+// stands in for a worker thread, but hands the tests to a worker process on the other end of fd
+// (see serve_coordinator) which does the replays and sends back its verdict
+// workers which connected over the network (rather than being started by us) must first send the token,
+// and only count as running once they did
+void feed_worker(CompareContext *ctx, int fd, bool authenticate) {
+    Channel channel(fd);
+    bool lost = false;
+
+    if (authenticate) {
+        // don't let a connection which never says hello hold us up
+        timeval timeout = {HELLO_TIMEOUT_SECONDS, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        if (!channel.recv_hello(Token)) {
+            std::cout << "Rejected a worker without the right token" << std::endl;
+            close_connection(ctx, fd);
+            return;
+        }
+        timeout = {0, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+        std::lock_guard<std::mutex> guard(ctx->progress_lock);
+        ctx->workers_running += 1;
+    }
+
+    Job job;
+    while (ctx->ktests.pop(job)) {
+        if (ctx->out_of_budget) {
+            break;
+        }
+
+        Step &step = *ctx->steps[job.step];
+        string ktest = step.outdir + "/klee-out/" + job.test;
+        if (skip_test(ctx, step, job.test, ktest)) {
+            continue;
+        }
+
+        std::ifstream in(ktest, std::ios::binary);
+        string contents((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+        Verdict verdict;
+        if (!channel.send_job(job.step, job.test, contents) || !channel.recv_verdict(verdict.outcome, verdict.result)) {
+            // the worker went away (or we cut it off), leave the test to someone else
+            if (!ctx->out_of_budget) {
+                std::cout << "Lost connection to worker, requeueing " << job.test << std::endl;
+            }
+            ctx->ktests.retry(job);
+            lost = true;
+            break;
+        }
+        if (!record_verdict(ctx, step, verdict)) {
+            break;
+        }
+    }
+
+    close_connection(ctx, fd);
+    if (lost) {
+        worker_lost(ctx);
+    } else {
+        worker_finished(ctx);
+    }
+}
+
+// accept connections from worker processes on sock and feed each of them tests, until sock is shut down
+void accept_workers(CompareContext *ctx, int sock, std::vector<std::thread> *connections) {
+    while (true) {
+        int fd = accept4(sock, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            return;
+        }
+
+        if (DEBUG_PRINTS) std::cout << "Worker connected" << std::endl;
+        {
+            std::lock_guard<std::mutex> guard(ctx->connections_lock);
+            ctx->connections.insert(fd);
+        }
+        connections->emplace_back(feed_worker, ctx, fd, true);
+    }
+}
+
+// run as a worker process, replaying the tests the coordinator on the other end of fd sends
+// the coordinator may be on another machine, so ctx->outdir is our own directory for the tests and replays
+int serve_coordinator(CompareContext *ctx, int fd) {
+    {
+        Replayer replayer(ctx, ctx->outdir + "/worker");
+        Channel channel(fd);
+
+        unsigned step;
+        string test, contents;
+        while (channel.recv_job(step, test, contents)) {
+            if (step >= ctx->steps.size()) {
+                std::cout << "Error: coordinator sent a test for an unknown step" << std::endl;
+                break;
+            }
+            // the name ends up in a path, so only take names KLEE could have given the test
+            if (!is_ktest(test) || test.find('/') != string::npos) {
+                std::cout << "Error: coordinator sent a test with a bad name" << std::endl;
+                break;
+            }
+
+            string ktest = ctx->outdir + "/" + test;
+            std::ofstream(ktest, std::ios::binary).write(contents.data(), contents.size());
+
+            Verdict verdict = replayer.compare(*ctx->steps[step], test, ktest);
+            std::filesystem::remove(ktest);
+            if (!channel.send_verdict(verdict.outcome, verdict.result)) {
+                break;
+            }
+        }
+    }
+
+    close(fd);
+    return 0;
+}
+
+// the files besides the versions which decide what a replay outputs, i.e. the tools doing the replay and
+// the runtime linked into the program, so rebuilding KLEE doesn't leave us with stale cached outputs
+std::vector<string> replay_tools(const string &klee_path) {
+    if (NativeReplay) {
+        return {klee_path + "/klee-replay", klee_path + "/../lib/libkleeRuntest.so"};
+    }
+
+    // wherever KLEE finds its runtime libraries, in the build tree or installed
+    std::vector<string> tools = {klee_path + "/klee"};
+    std::vector<string> runtime_dirs = {klee_path + "/../runtime/lib", klee_path + "/../lib/klee/runtime"};
+    if (const char *env = std::getenv("KLEE_RUNTIME_LIBRARY_PATH")) {
+        runtime_dirs = {env};
+    }
+    for (const string &dir : runtime_dirs) {
+        std::error_code ec;
+        for (const auto &entry : std::filesystem::directory_iterator(dir, ec)) {
+            if (entry.path().extension() == ".bca") {
+                tools.push_back(entry.path().string());
+            }
+        }
+    }
+    // the order of the directory doesn't matter to the key
+    std::sort(tools.begin() + 1, tools.end());
+    return tools;
+}
+
+// set up the versions of the program which are compared and the steps comparing them
+// returns false if they can't be replayed
+bool prepare_versions(CompareContext *ctx, string klee_path) {
+    // the versions from oldest to newest, every one of them is compared against the one before it
+    std::vector<string> bitcodes = {CompareFile};
+    bitcodes.insert(bitcodes.end(), Series.begin(), Series.end());
+    bitcodes.push_back(TargetFile);
+    for (const string &bitcode : bitcodes) {
+        ctx->versions.push_back({bitcode, "", ""});
+    }
+
+    for (unsigned i = 0; i + 1 < ctx->versions.size(); ++i) {
+        std::unique_ptr<Step> step(new Step());
+        step->original = i;
+        step->patched = i + 1;
+        ctx->steps.push_back(std::move(step));
+    }
+
+    // build every version natively up front, the replays only need to run them
+    if (NativeReplay) {
+        ctx->replay_command = klee_path + "/klee-replay";
+        for (unsigned i = 0; i < ctx->versions.size(); ++i) {
+            Version &version = ctx->versions[i];
+            version.native = ctx->outdir + "/version-" + std::to_string(i) + ".native";
+            if (!build_native(klee_path, version.bitcode, version.native)) {
+                std::cout << "Error: cannot build native versions for --native-replay" << std::endl;
+                return false;
+            }
+        }
+    }
+
+    // outputs depend on how the versions are replayed, and with what, as well as on their bitcode
+    if (CacheDir != "") {
+        string mode = NativeReplay ? "native " + NativeCC : ctx->klee_command;
+        ctx->cache.reset(new ReplayCache(CacheDir, mode, replay_tools(klee_path)));
+        for (Version &version : ctx->versions) {
+            version.cache_key = ctx->cache->version_key(version.bitcode);
+        }
+    }
+    return true;
+}
+
+// run KLEE exploring the patched version of the step, while the workers compare the tests it writes
+// returns once KLEE is done (or halted because a budget ran out) and all of its tests are queued
+void explore(CompareContext *ctx, unsigned index, const string &klee_command) {
+    Step &step = *ctx->steps[index];
+    string outdir_klee = step.outdir + "/klee-out";
+
+    // we'll create the klee output directory before klee does so that way we can
+    // watch it with inotify without missing any events
+    std::filesystem::create_directory(outdir_klee.c_str());
+
+    // start watching before KLEE starts writing tests, we only want to hear about
+    // ktests once KLEE is done writing them
+    int notif = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    int wdir = inotify_add_watch(notif, outdir_klee.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+    int stopfd = eventfd(0, EFD_CLOEXEC);
+    assert(notif >= 0 && wdir >= 0 && stopfd >= 0 && "Could not watch KLEE output directory");
+
+    // thread which collects tests output from KLEE and queues them
+    std::thread output_watch_thread(watch_klee_output, outdir_klee, index, notif, stopfd, ctx);
+
+    // create the command to run KLEE on the patched version of the step
+    string command = klee_command + " --output-dir " + outdir_klee;
+
+    // use patch-directed symbolic execution if specified
+    if (UseDirected) {
+        if (Pruning) {
+            command += " --pruning";
+        }
+        if (Distance) {
+            command += " --patch-priority-metric=distance";
+        }
+        command += " --search patch-priority --compare-bitcode " + ctx->versions[step.original].bitcode;
+
+        // the patch analysis is cached along with the replays
+        if (CacheDir != "") {
+            command += " --patch-priority-cache " + string(CacheDir) + "/priorities";
+        }
+    }
+
+    // if we stop KLEE early, it's because we already know enough, so don't make it write out every state
+    if (MaxDifferences > 0 || MaxComparedPaths > 0 || MaxTime > 0) {
+        command += " --dump-states-on-halt=false";
+    }
+
+    command += " " + ctx->versions[step.patched].bitcode;
+    for (const string &arg : InputArgv) {
+        command += " " + arg;
+    }
+
+    // redirect output from KLEE
+    command += " > " + step.outdir + "/klee_out.txt 2>&1";
+
+    // spawn an instance of klee which will explore the program
+    // the shell replaces itself with KLEE, so we can signal KLEE directly
+    {
+        std::lock_guard<std::mutex> guard(ctx->progress_lock);
+        ctx->exploring = true;
+    }
+    pid_t klee_pid = spawn_command("exec " + command);
+    assert(klee_pid > 0 && "Could not start KLEE instance");
+
+    // wait for KLEE in the background, so we notice as soon as a budget runs out
+    std::thread klee_wait_thread([ctx, klee_pid] {
+        wait_command(klee_pid);
+        std::lock_guard<std::mutex> guard(ctx->progress_lock);
+        ctx->exploring = false;
+        ctx->progress.notify_all();
+    });
+
+    if (!wait_for(ctx, [ctx] { return !ctx->exploring; })) {
+        // KLEE halts the same way it does on ctrl-c
+        std::lock_guard<std::mutex> guard(ctx->progress_lock);
+        if (ctx->exploring) {
+            kill(klee_pid, SIGINT);
+        }
+    }
+
+    // wait for KLEE to finish, then stop the watcher once it has queued the last tests
+    klee_wait_thread.join();
+    if (ctx->out_of_budget) {
+        // the workers stopped taking tests, don't leave the watcher waiting for room in the queue
+        ctx->ktests.cancel();
+    } else {
+        // nor when no worker ever connected to take them
+        std::lock_guard<std::mutex> guard(ctx->progress_lock);
+        replay_locally(ctx);
+    }
+    uint64_t stop = 1;
+    if (write(stopfd, &stop, sizeof(stop)) != sizeof(stop)) {
+        std::cout << "Error: cannot stop watching KLEE output directory" << std::endl;
+    }
+    output_watch_thread.join();
+    inotify_rm_watch(notif, wdir);
+    close(notif);
+    close(stopfd);
+}
+
+// seconds from the start of comparing until then
+double seconds_since_start(CompareContext *ctx, std::chrono::steady_clock::time_point then) {
+    return std::chrono::duration<double>(then - ctx->start).count();
+}
+
+// the timings of the whole run, so benchmarks can tell how quickly differences are found
+void write_timings(CompareContext *ctx, std::ostream &resout) {
+    resout << "Elapsed time: " << seconds_since_start(ctx, std::chrono::steady_clock::now()) << "s" << std::endl;
+    if (ctx->differences > 0) {
+        resout << "Time to first difference: " << seconds_since_start(ctx, ctx->first_difference) << "s" << std::endl;
+    }
+}
+
+// write the summary of the step at the end of its results file
+void write_summary(CompareContext *ctx, Step &step) {
+    step.resout << "\n";
+    if (ctx->out_of_budget) {
+        step.resout << "Stopped early: " << ctx->stop_reason << std::endl;
+    }
+    step.resout << "Paths compared: " << step.paths << std::endl;
+    step.resout << "Paths differing: " << step.differences << std::endl;
+    step.resout << "Paths skipped: " << step.skipped << std::endl;
+    step.resout << "Paths which failed to replay: " << step.failed << std::endl;
+    write_timings(ctx, step.resout);
+    step.resout.close();
 }
 
 int main(int argc, char **argv) {
@@ -236,60 +1031,184 @@ int main(int argc, char **argv) {
     const char *klee_path = std::getenv("KLEE_PATH");
     assert(klee_path && "Please set KLEE_PATH env var as the directory containing KLEE executable");
 
-    // create the output directory
-    string outdir = create_output_dir();
-    string outdir_klee = outdir + "/klee-out";
-
-    // we'll create the klee output directory before klee does so that way we can
-    // watch it with inotify without missing any events
-    std::filesystem::create_directory(outdir_klee.c_str());
-
-    if(std::filesystem::exists("/tmp/klee_compare_dump.txt")) {
-        std::filesystem::remove("/tmp/klee_compare_dump.txt");
-    } 
-
-    // create the command to run KLEE
     // hardcoding uclibc and posix-runtime args for now
     // TODO: these arguments should be set as options for klee-compare and passed through to klee
     string klee_command_prefix = string(klee_path) + "/klee --libc=uclibc --posix-runtime";
-    string klee_command = klee_command_prefix + " --output-dir " + outdir_klee;
 
-    // use patch-directed symbolic execution if specified
+    CompareContext ctx;
+    // the replays are fully concrete and we only need their outputs, not their test cases
+    ctx.klee_command = klee_command_prefix + " --concrete-replay --write-no-tests";
+
+    // as a worker process we only replay what the coordinator sends us
+    if (WorkerFd >= 0 || Connect != "") {
+        int fd = WorkerFd >= 0 ? (int) WorkerFd : connect_to(Connect);
+        if (fd < 0) {
+            std::cout << "Error: cannot connect to coordinator at " << Connect << std::endl;
+            return 1;
+        }
+        if (WorkerFd < 0) {
+            if (Token == "") {
+                std::cout << "Error: --connect needs the --token the coordinator printed" << std::endl;
+                return 1;
+            }
+            Channel(fd).send_hello(Token);
+        }
+
+        char tmpdir[] = "/tmp/klee-compare-worker-XXXXXX";
+        if (!mkdtemp(tmpdir)) {
+            std::cout << "Error: cannot create worker directory" << std::endl;
+            return 1;
+        }
+        ctx.outdir = tmpdir;
+
+        int status = prepare_versions(&ctx, klee_path) ? serve_coordinator(&ctx, fd) : 1;
+        std::filesystem::remove_all(ctx.outdir);
+        return status;
+    }
+
+    // create the output directory
+    string outdir = create_output_dir();
+    ctx.outdir = outdir;
     if (UseDirected) {
         std::cout << "Using Patch-Priority Searcher in KLEE" << std::endl;
-        if (Pruning) {
-            klee_command += " --pruning";
+    }
+    if (!prepare_versions(&ctx, klee_path)) {
+        return 1;
+    }
+
+    // a single comparison keeps everything in the output directory, a series gets a directory per step
+    for (unsigned i = 0; i < ctx.steps.size(); ++i) {
+        Step &step = *ctx.steps[i];
+        step.outdir = outdir;
+        if (!Series.empty()) {
+            step.outdir += "/step-" + std::to_string(i);
+            std::filesystem::create_directory(step.outdir);
         }
-        klee_command += " --search patch-priority --compare-bitcode " + CompareFile;
+        step.resout.open(step.outdir + "/results.txt");
     }
 
-    for (unsigned i = 0; i < InputArgv.size() + 1; i++) {
-        string &arg = (i==0 ? TargetFile : InputArgv[i-1]);
-        klee_command += " " + arg;
+    // the time budget covers everything from here on
+    ctx.start = std::chrono::steady_clock::now();
+    ctx.deadline = ctx.start + std::chrono::seconds(MaxTime);
+
+    // launch the compare workers in their own threads, which recieve the test files
+    // in the queue once we know they exist
+    // the workers are shared by all steps, so the replays of one step overlap with exploring the next
+    // with worker processes doing the replays, we don't need any here unless asked for
+    unsigned jobs = Jobs;
+    if (Jobs.getNumOccurrences() == 0 && (LocalWorkers > 0 || Listen > 0)) {
+        jobs = 0;
+    }
+    std::vector<std::thread> comparison_threads;
+    ctx.workers_running = jobs + LocalWorkers;
+    for (unsigned i = 0; i < jobs; ++i) {
+        comparison_threads.emplace_back(compare, &ctx, i);
     }
 
-    // redirect output from KLEE
-    klee_command += " &> " + outdir + "/klee_out.txt";
+    // start the local worker processes, each gets our options and talks to its own thread here
+    std::vector<pid_t> worker_pids;
+    for (unsigned i = 0; i < LocalWorkers; ++i) {
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0) {
+            std::cout << "Error: cannot start local worker" << std::endl;
+            return 1;
+        }
 
-    // spawn an instance of klee which will explore the program
-    FILE *kleefd = popen(klee_command.c_str(), "w");
-    assert(kleefd != nullptr && "Could not start KLEE instance");
+        std::vector<string> worker_argv = {"/proc/self/exe", "--worker-fd=" + std::to_string(fds[1])};
+        worker_argv.insert(worker_argv.end(), argv + 1, argv + argc);
+        worker_pids.push_back(spawn_process(worker_argv, {fds[1]}));
+        close(fds[1]);
+        ctx.connections.insert(fds[0]);
+        comparison_threads.emplace_back(feed_worker, &ctx, fds[0], false);
+    }
 
-    bool done = false;
-    std::queue<string> ktests;
+    // and wait for workers on other machines
+    int listen_sock = -1;
+    std::vector<std::thread> connections;
+    std::thread accept_thread;
+    if (Listen > 0) {
+        if (Token == "") {
+            Token = make_token();
+            if (Token == "") {
+                std::cout << "Error: cannot make a token for workers, give one with --token" << std::endl;
+                return 1;
+            }
+        }
+        listen_sock = listen_on(ListenAddress, Listen);
+        if (listen_sock < 0) {
+            std::cout << "Error: cannot listen for workers on port " << Listen << std::endl;
+            return 1;
+        }
+        std::cout << "Listening for workers on port " << Listen << ", start them with --token=" << Token << std::endl;
+        accept_thread = std::thread(accept_workers, &ctx, listen_sock, &connections);
+    }
 
-    // launch the compare function in a thread, which recieves the test files
-    // in the queue once we know they exist
-    std::thread comparison_thread(compare, &done, klee_command_prefix, outdir, &ktests);
-    
-    // thread which collects tests output from KLEE and queues them
-    std::thread output_watch_thread(watch_klee_output, outdir_klee, &ktests);
-    
-    // sleep for a bit and then join the other thread once it's done
-    pclose(kleefd);
-    std::this_thread::sleep_for(std::chrono::seconds(2));
-    done = true; // stops loop in comparison_thread 
-    comparison_thread.join();
-    // TODO: is there a nicer way to this? make complains when it gets the interrupt
-    pthread_kill(output_watch_thread.native_handle(), SIGINT);
+    // explore the steps one after the other
+    for (unsigned i = 0; i < ctx.steps.size() && !ctx.out_of_budget; ++i) {
+        explore(&ctx, i, klee_command_prefix);
+    }
+
+    // let the workers finish comparing what's queued, unless we're out of budget
+    // in which case what's queued is dropped and the workers only finish the tests they are on
+    if (ctx.out_of_budget) {
+        ctx.ktests.cancel();
+    } else {
+        ctx.ktests.close();
+        if (!wait_for(&ctx, [&ctx] { return ctx.workers_running == 0 && ctx.ktests.empty(); })) {
+            ctx.ktests.cancel();
+        }
+    }
+    if (listen_sock >= 0) {
+        shutdown(listen_sock, SHUT_RDWR);
+        accept_thread.join();
+        close(listen_sock);
+    }
+
+    // whoever is still connected is either waiting for a test which won't come, or replaying one
+    // whose verdict we no longer need, so don't wait on them
+    {
+        std::lock_guard<std::mutex> guard(ctx.connections_lock);
+        for (int fd : ctx.connections) {
+            shutdown(fd, SHUT_RDWR);
+        }
+    }
+    for (std::thread &t : connections) {
+        t.join();
+    }
+    for (std::thread &t : comparison_threads) {
+        t.join();
+    }
+    for (std::thread &t : ctx.fallback_workers) {
+        t.join();
+    }
+    for (pid_t pid : worker_pids) {
+        wait_command(pid);
+    }
+
+    // print summary of comparison results
+    for (auto &step : ctx.steps) {
+        if (step->skipped > 0 && step->paths == 0 && step->failed == 0) {
+            std::cout << "Warning: every test of " << step->outdir << " was skipped for not running patched code, "
+                      << "nothing was compared (see --skip-unpatched)" << std::endl;
+        }
+        write_summary(&ctx, *step);
+    }
+
+    // and of the whole series
+    if (!Series.empty()) {
+        std::ofstream resout(outdir + "/results.txt");
+        for (unsigned i = 0; i < ctx.steps.size(); ++i) {
+            Step &step = *ctx.steps[i];
+            resout << "Step " << i << ": " << ctx.versions[step.original].bitcode << " -> "
+                   << ctx.versions[step.patched].bitcode << ": " << step.paths << " paths compared, "
+                   << step.differences << " differing, " << step.skipped << " skipped" << std::endl;
+        }
+        resout << "\n";
+        if (ctx.out_of_budget) {
+            resout << "Stopped early: " << ctx.stop_reason << std::endl;
+        }
+        resout << "Paths compared: " << ctx.paths << std::endl;
+        resout << "Paths differing: " << ctx.differences << std::endl;
+        write_timings(&ctx, resout);
+    }
 }
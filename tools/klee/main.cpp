@@ -247,6 +247,15 @@ namespace {
                  cl::value_desc("output directory"),
                  cl::cat(ReplayCat));
 
+  cl::opt<int>
+  ReplayServerFd("replay-server-fd",
+                 cl::desc("Replay the ktest files requested over this file descriptor "
+                          "until it is closed, keeping the module loaded between "
+                          "replays (used by klee-compare)"),
+                 cl::value_desc("fd"),
+                 cl::init(-1),
+                 cl::cat(ReplayCat));
+
   cl::opt<std::string>
   ReplayPathFile("replay-path",
                  cl::desc("Specify a path file to replay"),
@@ -520,6 +529,15 @@ void KleeHandler::processTestCase(const ExecutionState &state,
         std::copy(out[i].second.begin(), out[i].second.end(), o->bytes);
       }
 
+      // musa: record if the test ran patched code, before the ktest is written so that
+      // klee-compare finds it as soon as it sees the ktest
+      bool ranPatchedCode;
+      if (m_interpreter->getRanPatchedCode(state, ranPatchedCode)) {
+        auto f = openTestFile("patch", id);
+        if (f)
+          *f << (ranPatchedCode ? 1 : 0) << '\n';
+      }
+
       if (!kTest_toFile(&b, getOutputFilename(getTestFilename("ktest", id)).c_str())) {
         klee_warning("unable to write output test case, losing it");
       } else {
@@ -1226,6 +1244,65 @@ static void prepareBitcode(std::vector<std::unique_ptr<llvm::Module>> &loadedMod
   }
 }
 
+// Musa: replay server for klee-compare. Every request on fd is a line of the form
+// "<ktest file>[\t<dump file>]": the ktest is replayed with the dump file passed to the
+// POSIX-Compare runtime through KLEE_COMPARE_DUMP (if there is none, the runtime uses
+// the capture named by KLEE_COMPARE_FD in our environment), and the request is answered
+// with "ok" or "error" once the replay is done. Returns when fd is closed or on ctrl-c.
+static void serveReplayRequests(Interpreter *interpreter, Function *mainFn,
+                                int fd, char **envp) {
+  FILE *requests = fdopen(fd, "r");
+  if (!requests)
+    klee_error("unable to open replay server fd %d: %s", fd,
+               sys::StrError(errno).c_str());
+
+  // the environment of the replayed program, minus any dump path we inherited
+  static const char dumpVar[] = "KLEE_COMPARE_DUMP=";
+  std::vector<char *> env;
+  for (char **e = envp; *e; ++e) {
+    if (strncmp(*e, dumpVar, sizeof(dumpVar) - 1) != 0)
+      env.push_back(*e);
+  }
+
+  char *line = nullptr;
+  size_t capacity = 0;
+  ssize_t length;
+  while (!interrupted && (length = getline(&line, &capacity, requests)) > 0) {
+    std::string request(line, length);
+    if (request.back() == '\n')
+      request.pop_back();
+
+    std::string::size_type tab = request.find('\t');
+    std::string kTestFile = request.substr(0, tab);
+    std::string dump;
+    if (tab != std::string::npos)
+      dump = dumpVar + request.substr(tab + 1);
+
+    const char *reply = "error\n";
+    if (KTest *out = kTest_fromFile(kTestFile.c_str())) {
+      std::vector<char *> runEnv(env);
+      if (!dump.empty())
+        runEnv.push_back(&dump[0]);
+      runEnv.push_back(nullptr);
+
+      interpreter->setReplayKTest(out);
+      interpreter->runFunctionAsMain(mainFn, out->numArgs, out->args,
+                                     runEnv.data());
+      interpreter->setReplayKTest(0);
+      kTest_free(out);
+      reply = "ok\n";
+    } else {
+      klee_warning("unable to open: %s\n", kTestFile.c_str());
+    }
+
+    if (write(fd, reply, strlen(reply)) < 0)
+      break;
+  }
+
+  free(line);
+  fclose(requests);
+}
+
 int main(int argc, char **argv, char **envp) {
   atexit(llvm_shutdown);  // Call llvm_shutdown() on exit.
 
@@ -1507,7 +1584,20 @@ int main(int argc, char **argv, char **envp) {
     handler->getInfoStream().flush();
   }
 
-  if (!ReplayKTestDir.empty() || !ReplayKTestFile.empty()) {
+  if (ReplayServerFd >= 0) {
+    assert(SeedOutFile.empty());
+    assert(SeedOutDir.empty());
+
+    if (RunInDir != "") {
+      int res = chdir(RunInDir.c_str());
+      if (res < 0) {
+        klee_error("Unable to change directory to: %s - %s", RunInDir.c_str(),
+                   sys::StrError(errno).c_str());
+      }
+    }
+
+    serveReplayRequests(interpreter, mainFn, ReplayServerFd, pEnvp);
+  } else if (!ReplayKTestDir.empty() || !ReplayKTestFile.empty()) {
     assert(SeedOutFile.empty());
     assert(SeedOutDir.empty());
 
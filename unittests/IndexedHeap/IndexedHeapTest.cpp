@@ -0,0 +1,103 @@
+#include "klee/ADT/IndexedHeap.h"
+#include "gtest/gtest.h"
+
+#include <cstdlib>
+#include <map>
+#include <vector>
+
+using namespace klee;
+
+namespace {
+
+struct Item {
+  int id;
+  std::size_t heapIndex = 0;
+};
+
+struct ItemIndex {
+  std::size_t &operator()(Item *item) const { return item->heapIndex; }
+};
+
+typedef IndexedHeap<Item *, int, ItemIndex> Heap;
+
+TEST(IndexedHeapTest, Basic) {
+  Heap heap;
+  std::vector<Item> items(5);
+  for (int i = 0; i < 5; ++i)
+    items[i].id = i;
+
+  ASSERT_TRUE(heap.empty());
+  ASSERT_FALSE(heap.contains(&items[0]));
+
+  heap.push(&items[0], 3);
+  heap.push(&items[1], 7);
+  heap.push(&items[2], 1);
+  ASSERT_EQ(3u, heap.size());
+  ASSERT_EQ(&items[1], heap.top());
+  ASSERT_EQ(7, heap.topKey());
+
+  // raise and lower keys
+  heap.update(&items[2], 10);
+  ASSERT_EQ(&items[2], heap.top());
+  heap.update(&items[2], 0);
+  ASSERT_EQ(&items[1], heap.top());
+  ASSERT_EQ(0, heap.getKey(&items[2]));
+
+  // remove from the middle and the top
+  heap.remove(&items[0]);
+  ASSERT_FALSE(heap.contains(&items[0]));
+  heap.pop();
+  ASSERT_EQ(&items[2], heap.top());
+  heap.pop();
+  ASSERT_TRUE(heap.empty());
+
+  // items which were never pushed aren't in the heap, whatever their index
+  items[3].heapIndex = 0;
+  heap.push(&items[4], 1);
+  ASSERT_FALSE(heap.contains(&items[3]));
+  ASSERT_TRUE(heap.contains(&items[4]));
+}
+
+TEST(IndexedHeapTest, Random) {
+  Heap heap;
+  std::vector<Item> items(200);
+  std::map<Item *, int> keys;
+  for (int i = 0; i < 200; ++i)
+    items[i].id = i;
+
+  srand(42);
+  for (int step = 0; step < 20000; ++step) {
+    Item *item = &items[rand() % items.size()];
+    int key = rand() % 50;
+
+    if (!heap.contains(item)) {
+      heap.push(item, key);
+      keys[item] = key;
+    } else if (rand() % 3 == 0) {
+      heap.remove(item);
+      keys.erase(item);
+    } else {
+      heap.update(item, key);
+      keys[item] = key;
+    }
+
+    ASSERT_EQ(keys.size(), heap.size());
+    if (!heap.empty()) {
+      int max = -1;
+      for (auto &entry : keys)
+        max = std::max(max, entry.second);
+      ASSERT_EQ(max, heap.topKey());
+      ASSERT_EQ(keys[heap.top()], heap.topKey());
+    }
+  }
+
+  // pops in order
+  int last = 100;
+  while (!heap.empty()) {
+    ASSERT_LE(heap.topKey(), last);
+    last = heap.topKey();
+    heap.pop();
+  }
+}
+
+} // namespace